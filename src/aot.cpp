@@ -0,0 +1,56 @@
+#include <vector>
+#include <memory>
+
+#include "aot.hpp"
+
+// filled by the static AotRegistrars of the generated files, before main().
+static std::vector<std::unique_ptr<AotTable>>& registry() {
+    static std::vector<std::unique_ptr<AotTable>> tables;
+    return tables;
+}
+
+AotRegistrar::AotRegistrar(const AotProgram &program) {
+    auto table = std::make_unique<AotTable>();
+    table->program = &program;
+    for (size_t addr = 0; addr < MEM_SIZE; addr++) {
+        table->blocks[addr] = nullptr;
+        table->firsts[addr] = 0;
+        table->lengths[addr] = 0;
+        table->covered[addr] = false;
+    }
+    for (size_t i = 0; i < program.count; i++) {
+        const AotEntry &entry = program.entries[i];
+        for (size_t i = 0; i < entry.length && entry.addr + 2 * i < MEM_SIZE; i++) {
+            size_t a = entry.addr + 2 * i;
+            // where blocks overlap, one starting at a wins over one covering it.
+            if (i == 0 || !table->blocks[a]) {
+                table->blocks[a] = entry.block;
+                table->firsts[a] = i;
+                table->lengths[a] = entry.length;
+            }
+        }
+        for (size_t a = entry.addr; a < entry.addr + 2u * entry.length && a < MEM_SIZE; a++) {
+            table->covered[a] = true;
+        }
+    }
+    registry().push_back(std::move(table));
+}
+
+const AotTable* AotRegistrar::find(const Chip8 &chips) {
+    if (registry().empty()) {
+        return nullptr;
+    }
+    uint8_t mem[MEM_SIZE];
+    chips.copyMemory(mem);
+    for (const auto &table : registry()) {
+        const AotProgram *program = table->program;
+        if (std::memcmp(mem + START_ADDR, program->rom, program->size) == 0) {
+            return table.get();
+        }
+    }
+    return nullptr;
+}
+
+size_t AotRegistrar::count() {
+    return registry().size();
+}
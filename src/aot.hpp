@@ -0,0 +1,104 @@
+#ifndef CHIPS_AOT
+#define CHIPS_AOT
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "chip8.hpp"
+
+#define AOT_MAX_BLOCK 64 // max instructions per translated block
+
+// ahead-of-time translations of known roms, see translate.cpp (chips-aot).
+//
+// chips-aot follows a rom's control flow from START_ADDR and writes a C++
+// file with one function per basic block, operands baked in. the build
+// compiles the ones for roms/ into the binaries, each registers itself at
+// startup. Backend::Aot picks the translation whose bytes match what's in
+// memory and runs its blocks, anything without a block (Fx0A, invalid
+// opcodes, addresses the walk never reached) goes through the decode cache.
+// a write to translated code drops the translation for that machine until
+// the next load or reset.
+
+// a block runs its instructions from index from up to (not including) to
+// on the machine and returns the next pc. a budget that ends inside a block
+// splits it there, the next run enters it again at the instruction it
+// stopped at.
+typedef uint16_t (*AotBlock)(Chip8 &chips, unsigned from, unsigned to);
+
+struct AotEntry {
+    uint16_t addr;
+    uint8_t length; // instructions, the cycles the block takes
+    AotBlock block;
+};
+
+// what a generated file hands to AotRegistrar.
+struct AotProgram {
+    const char *name;
+    const uint8_t *rom; // the bytes it was translated from, at START_ADDR
+    size_t size;
+    const AotEntry *entries;
+    size_t count;
+};
+
+// a registered program, indexed by address for the dispatcher.
+struct AotTable {
+    const AotProgram *program;
+    AotBlock blocks[MEM_SIZE]; // the block starting at each address, else one covering it
+    uint8_t firsts[MEM_SIZE];  // the index of the instruction at the address in it
+    uint8_t lengths[MEM_SIZE]; // its instructions
+    bool covered[MEM_SIZE]; // bytes some block was translated from
+};
+
+class AotRegistrar {
+public:
+    explicit AotRegistrar(const AotProgram &program);
+
+    // the translation of whatever rom is in chips' memory, nullptr if none.
+    static const AotTable* find(const Chip8 &chips);
+    static size_t count();
+};
+
+// the machine as generated code sees it. everything here is inline and
+// mirrors Chip8::interpret(), so a block compiles down to plain loads and
+// stores on the Chip8 fields.
+class AotMachine {
+private:
+    Chip8 &c;
+public:
+    uint8_t *const v;
+    uint16_t &index;
+
+    explicit AotMachine(Chip8 &c) : c(c), v(c.v), index(c.index) {}
+
+    void cls() {
+        std::memset(c.graphics, 0, sizeof(c.graphics));
+        c.display_dirty = true;
+        c.stores++;
+    }
+    void draw(uint8_t x, uint8_t y, uint8_t height) { c.drawSprite(v[x], v[y], height); }
+    void call(uint16_t ret) { c.push(ret); }
+    uint16_t ret() { return c.pop(); }
+    uint8_t rnd() { return pcgNext(c.rng) >> 24; }
+    uint8_t delay() {
+        c.polled = true;
+        return c.delay_timer;
+    }
+    void setDelay(uint8_t x) { c.delay_timer = v[x]; }
+    void setSound(uint8_t x) {
+        c.sound_timer = v[x];
+        c.soundChanged();
+    }
+    bool key(uint8_t x) {
+        c.polled = true;
+        return c.keys[v[x] % NUM_KEYS];
+    }
+    void bcd(uint8_t x) {
+        uint8_t bcd[3] = {uint8_t(v[x] / 100), uint8_t((v[x] % 100) / 10), uint8_t(v[x] % 10)};
+        c.writeMem(index, bcd, 3);
+    }
+    void store(uint8_t x) { c.writeMem(index, v, x + 1); }
+    void load(uint8_t x) { c.readMem(index, v, x + 1); }
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include <cmath>
+#include <algorithm>
+
+#include "audio.hpp"
+
+// correction for a unit step at phase 0, spread over the sample either side.
+static double polyBlep(double t, double dt) {
+    if (t < dt) {
+        t /= dt;
+        return t + t - t * t - 1.0;
+    }
+    if (t > 1.0 - dt) {
+        t = (t - 1.0) / dt;
+        return t * t + t + t + 1.0;
+    }
+    return 0.0;
+}
+
+SquareWave::SquareWave(AudioQueue &queue) : queue(queue), play(0), started(false), on(false), gain(0), phase(0) {}
+
+void SquareWave::render(float *out, int samples) {
+    const double samples_per_tick = double(AUDIO_RATE) / AUDIO_TICK_HZ;
+    const double dt = double(BEEP_HZ) / AUDIO_RATE;
+
+    double now = queue.now.load(std::memory_order_acquire);
+    if (!started || play < now - AUDIO_MAX_LAG_TICKS) {
+        play = now - AUDIO_LATENCY_TICKS;
+        started = true;
+    }
+
+    for (int i = 0; i < samples; i++) {
+        // edges take effect on the first sample at or after their tick.
+        double t = play + i / samples_per_tick;
+        for (const AudioEdge *edge = queue.edges.front(); edge && edge->tick <= t; edge = queue.edges.front()) {
+            on = edge->on;
+            queue.edges.pop();
+        }
+
+        gain = on ? std::min(1.0f, gain + 1.0f / BEEP_RAMP) : std::max(0.0f, gain - 1.0f / BEEP_RAMP);
+        double wave = phase < 0.5 ? 1.0 : -1.0;
+        wave += polyBlep(phase, dt);
+        wave -= polyBlep(std::fmod(phase + 0.5, 1.0), dt);
+        out[i] = float(wave) * gain * BEEP_VOLUME;
+
+        phase += dt;
+        if (phase >= 1.0) {
+            phase -= 1.0;
+        }
+    }
+
+    // never ahead of the machine: if it stopped, the buzzer holds where it is.
+    play = std::min(play + samples / samples_per_tick, now);
+}
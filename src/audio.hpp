@@ -0,0 +1,52 @@
+#ifndef CHIPS_AUDIO
+#define CHIPS_AUDIO
+
+#include <atomic>
+#include <cstdint>
+
+#include "spsc.hpp"
+
+#define AUDIO_RATE 48000        // samples per second
+#define AUDIO_BUFFER 512        // samples per device callback
+#define AUDIO_QUEUE_SIZE 256    // sound edges in flight, a few seconds of the busiest rom
+#define AUDIO_TICK_HZ 60        // the sound timer's rate, edges are stamped in its ticks
+#define AUDIO_LATENCY_TICKS 2   // how far playback trails the machine
+#define AUDIO_MAX_LAG_TICKS 8   // further behind than this, playback skips ahead
+#define BEEP_HZ 440
+#define BEEP_VOLUME 0.2f
+#define BEEP_RAMP 48            // samples to fade in or out, keeps edges from clicking
+
+// the buzzer turning on or off, at a timer tick of the machine.
+struct AudioEdge {
+    uint64_t tick;
+    bool on;
+};
+
+// what the machine hands to the audio thread: sound edges in order, and the
+// tick the machine has got to, so playback can follow it. one producer (the
+// thread running the machine), one consumer (the audio callback).
+struct AudioQueue {
+    SpscQueue<AudioEdge, AUDIO_QUEUE_SIZE> edges;
+    alignas(64) std::atomic<uint64_t> now{0};
+};
+
+// renders the edges as a 440 Hz square wave, band-limited with polyBLEP so
+// it doesn't alias at 48 kHz. playback runs AUDIO_LATENCY_TICKS behind the
+// machine and each edge starts on its exact sample. if the machine stops
+// (paused, rewinding) the buzzer holds, if it runs ahead (uncapped) playback
+// jumps to catch up. consumer side only, called from the audio callback.
+class SquareWave {
+private:
+    AudioQueue &queue;
+    double play;     // position in ticks
+    bool started;
+    bool on;
+    float gain;      // 0..1, ramps towards on
+    double phase;    // 0..1 through one period
+public:
+    explicit SquareWave(AudioQueue &queue);
+
+    void render(float *out, int samples);
+};
+
+#endif
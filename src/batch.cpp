@@ -0,0 +1,458 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+#include "batch.hpp"
+#include "romcache.hpp"
+
+#define NUM_CLASSES 32 // 16 top nibbles + 16 sub-ops of 0x8xyN
+
+namespace {
+
+// all lanes run the same opcode, walk the columns directly.
+struct AllLanes {
+    size_t count;
+    uint16_t opcode;
+
+    size_t size() const { return count; }
+    size_t lane(size_t i) const { return i; }
+    uint16_t op(size_t) const { return opcode; }
+};
+
+// a subset of lanes, each with its own opcode.
+struct LaneList {
+    const uint32_t *ids;
+    size_t count;
+    const uint16_t *opcodes;
+
+    size_t size() const { return count; }
+    size_t lane(size_t i) const { return ids[i]; }
+    uint16_t op(size_t i) const { return opcodes[ids[i]]; }
+};
+
+// 0x8xyN gets one class per sub-op so each ALU op is its own kernel,
+// everything else is classed by the top nibble.
+inline int opClass(uint16_t opcode) {
+    int hi = opcode >> 12;
+    return hi == 0x8 ? 16 + (opcode & 0x000F) : hi;
+}
+
+}
+
+Chip8Batch::Chip8Batch(size_t lanes)
+    : lanes(lanes),
+      v(NUM_REGS * lanes, 0),
+      stack(STACK_SIZE * lanes, 0),
+      index(lanes, 0),
+      pc(lanes, START_ADDR),
+      sp(lanes, 0xFF), // -1 means empty, same as Chip8
+      delay_timer(lanes, 0),
+      sound_timer(lanes, 0),
+      rng(lanes),
+      mem(MEM_SIZE * lanes, 0),
+      graphics(SCREEN_HEIGHT * lanes, 0),
+      keys(NUM_KEYS * lanes, 0),
+      opcodes(lanes, 0),
+      order(lanes, 0),
+      invalid_count(0) {
+    for (int i = 0; i < FONT_SIZE; i++) {
+        std::fill_n(&mem[(FONT_ADDR + i) * lanes], lanes, Chip8::fonts[i]);
+    }
+    setSeed(DEFAULT_SEED);
+}
+
+void Chip8Batch::setSeed(uint64_t seed) {
+    for (size_t lane = 0; lane < lanes; lane++) {
+        rng[lane] = pcgSeed(seed + lane);
+    }
+}
+
+bool Chip8Batch::loadRom(const std::string& rom_file) {
+    RomFile rom(rom_file);
+    if (!rom.ok()) {
+        return false;
+    }
+
+    // every lane gets the same byte at each address.
+    std::span<const uint8_t> data = rom.bytes();
+    for (size_t i = 0; i < data.size(); i++) {
+        std::fill_n(&mem[(START_ADDR + i) * lanes], lanes, data[i]);
+    }
+    return true;
+}
+
+template <typename Lanes>
+void Chip8Batch::execute(int op_class, const Lanes &ls) {
+    const size_t n = ls.size();
+    uint8_t *vf = &v[0xF * lanes];
+
+    switch (op_class) {
+        case 0x1: // goto nnn
+            for (size_t i = 0; i < n; i++) {
+                pc[ls.lane(i)] = ls.op(i) & 0x0FFF;
+            }
+            break;
+        case 0x2: // call nnn
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                sp[l]++;
+                stack[(sp[l] & (STACK_SIZE - 1)) * lanes + l] = pc[l];
+                pc[l] = ls.op(i) & 0x0FFF;
+            }
+            break;
+        case 0x3: // skip if Vx == kk
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                pc[l] += (v[((op & 0x0F00) >> 8) * lanes + l] == (op & 0x00FF)) ? 2 : 0;
+            }
+            break;
+        case 0x4: // skip if Vx != kk
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                pc[l] += (v[((op & 0x0F00) >> 8) * lanes + l] != (op & 0x00FF)) ? 2 : 0;
+            }
+            break;
+        case 0x5: // skip if Vx == Vy
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                pc[l] += (v[((op & 0x0F00) >> 8) * lanes + l] == v[((op & 0x00F0) >> 4) * lanes + l]) ? 2 : 0;
+            }
+            break;
+        case 0x6: // Vx = kk
+            for (size_t i = 0; i < n; i++) {
+                uint16_t op = ls.op(i);
+                v[((op & 0x0F00) >> 8) * lanes + ls.lane(i)] = op & 0x00FF;
+            }
+            break;
+        case 0x7: // Vx += kk
+            for (size_t i = 0; i < n; i++) {
+                uint16_t op = ls.op(i);
+                v[((op & 0x0F00) >> 8) * lanes + ls.lane(i)] += op & 0x00FF;
+            }
+            break;
+        case 0x9: // skip if Vx != Vy
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                pc[l] += (v[((op & 0x0F00) >> 8) * lanes + l] != v[((op & 0x00F0) >> 4) * lanes + l]) ? 2 : 0;
+            }
+            break;
+        case 0xA: // I = nnn
+            for (size_t i = 0; i < n; i++) {
+                index[ls.lane(i)] = ls.op(i) & 0x0FFF;
+            }
+            break;
+        case 0xB: // goto nnn + V0
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                pc[l] = ((ls.op(i) & 0x0FFF) + v[l]) & (MEM_SIZE - 1);
+            }
+            break;
+        case 0xC: // Vx = rand & kk
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                v[((op & 0x0F00) >> 8) * lanes + l] = (pcgNext(rng[l]) >> 24) & (op & 0x00FF);
+            }
+            break;
+
+        // the flag writes below follow the same order as Chip8::cycle(),
+        // so the results match even when x or y is 0xF.
+        case 16 + 0x0: // Vx = Vy
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                v[((op & 0x0F00) >> 8) * lanes + l] = v[((op & 0x00F0) >> 4) * lanes + l];
+            }
+            break;
+        case 16 + 0x1: // Vx |= Vy
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                v[((op & 0x0F00) >> 8) * lanes + l] |= v[((op & 0x00F0) >> 4) * lanes + l];
+            }
+            break;
+        case 16 + 0x2: // Vx &= Vy
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                v[((op & 0x0F00) >> 8) * lanes + l] &= v[((op & 0x00F0) >> 4) * lanes + l];
+            }
+            break;
+        case 16 + 0x3: // Vx ^= Vy
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                v[((op & 0x0F00) >> 8) * lanes + l] ^= v[((op & 0x00F0) >> 4) * lanes + l];
+            }
+            break;
+        case 16 + 0x4: // Vx += Vy, VF = carry
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                uint8_t *vx = &v[((op & 0x0F00) >> 8) * lanes + l];
+                uint8_t *vy = &v[((op & 0x00F0) >> 4) * lanes + l];
+                vf[l] = (*vx + *vy) > UINT8_MAX;
+                *vx += *vy;
+            }
+            break;
+        case 16 + 0x5: // Vx -= Vy, VF = no borrow
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                uint8_t *vx = &v[((op & 0x0F00) >> 8) * lanes + l];
+                uint8_t *vy = &v[((op & 0x00F0) >> 4) * lanes + l];
+                vf[l] = *vx > *vy;
+                *vx -= *vy;
+            }
+            break;
+        case 16 + 0x6: // Vx >>= 1, VF = lsb
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint8_t *vx = &v[((ls.op(i) & 0x0F00) >> 8) * lanes + l];
+                vf[l] = *vx & 0x1;
+                *vx >>= 1;
+            }
+            break;
+        case 16 + 0x7: // Vx = Vy - Vx, VF = no borrow
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint16_t op = ls.op(i);
+                uint8_t *vx = &v[((op & 0x0F00) >> 8) * lanes + l];
+                uint8_t *vy = &v[((op & 0x00F0) >> 4) * lanes + l];
+                vf[l] = *vx < *vy;
+                *vx = *vy - *vx;
+            }
+            break;
+        case 16 + 0xE: // Vx <<= 1, VF = msb
+            for (size_t i = 0; i < n; i++) {
+                size_t l = ls.lane(i);
+                uint8_t *vx = &v[((ls.op(i) & 0x0F00) >> 8) * lanes + l];
+                vf[l] = (*vx & 0x80) >> 7;
+                *vx <<= 1;
+            }
+            break;
+        default:
+            // 0x0, 0xD, 0xE, 0xF and the invalid 0x8 sub-ops touch memory,
+            // the screen or the keys per lane, nothing to vectorize there.
+            for (size_t i = 0; i < n; i++) {
+                executeScalar(ls.lane(i), ls.op(i));
+            }
+    }
+}
+
+void Chip8Batch::executeScalar(size_t l, uint16_t opcode) {
+    auto m = [&](uint16_t addr) -> uint8_t& { return mem[(addr & (MEM_SIZE - 1)) * lanes + l]; };
+    const size_t x = (opcode & 0x0F00) >> 8;
+    uint8_t &vx = v[x * lanes + l];
+    bool invalid = false;
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            switch (opcode & 0x00FF) {
+                case 0x00E0:
+                    std::fill_n(&graphics[l * SCREEN_HEIGHT], SCREEN_HEIGHT, 0);
+                    break;
+                case 0x00EE:
+                    pc[l] = stack[(sp[l] & (STACK_SIZE - 1)) * lanes + l];
+                    sp[l]--;
+                    break;
+                default:
+                    invalid = true;
+            }
+            break;
+        case 0xD000: {
+            uint8_t x_pos = vx;
+            uint8_t y_pos = v[((opcode & 0x00F0) >> 4) * lanes + l];
+            uint8_t height = opcode & 0x000F;
+            uint64_t *screen = &graphics[l * SCREEN_HEIGHT];
+
+            uint64_t flipped = 0;
+            for (int y_dir = 0; y_dir < height; y_dir++) {
+                uint64_t sprite = spriteRow(m(index[l] + y_dir), x_pos);
+                uint64_t &row = screen[(y_pos + y_dir) % SCREEN_HEIGHT];
+                flipped |= row & sprite;
+                row ^= sprite;
+            }
+            v[0xF * lanes + l] = flipped != 0;
+            break;
+        }
+        case 0xE000:
+            switch (opcode & 0x00FF) {
+                case 0x009E:
+                    if (keys[l * NUM_KEYS + (vx & 0xF)])
+                        pc[l] += 2;
+                    break;
+                case 0x00A1:
+                    if (!keys[l * NUM_KEYS + (vx & 0xF)])
+                        pc[l] += 2;
+                    break;
+                default:
+                    invalid = true;
+            }
+            break;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0007:
+                    vx = delay_timer[l];
+                    break;
+                case 0x000A: {
+                    bool pressed = false;
+                    for (int i = 0; i < NUM_KEYS; i++) {
+                        if (keys[l * NUM_KEYS + i]) {
+                            pressed = true;
+                            vx = i;
+                            break;
+                        }
+                    }
+                    if (!pressed)
+                        pc[l] -= 2;
+                    break;
+                }
+                case 0x0015:
+                    delay_timer[l] = vx;
+                    break;
+                case 0x0018:
+                    sound_timer[l] = vx;
+                    break;
+                case 0x001E:
+                    index[l] += vx;
+                    break;
+                case 0x0029:
+                    index[l] = FONT_ADDR + vx * 0x5;
+                    break;
+                case 0x0033:
+                    m(index[l]) = vx / 100;
+                    m(index[l] + 1) = (vx % 100) / 10;
+                    m(index[l] + 2) = vx % 10;
+                    break;
+                case 0x0055:
+                    for (size_t idx = 0; idx <= x; idx++) {
+                        m(index[l] + idx) = v[idx * lanes + l];
+                    }
+                    break;
+                case 0x0065:
+                    for (size_t idx = 0; idx <= x; idx++) {
+                        v[idx * lanes + l] = m(index[l] + idx);
+                    }
+                    break;
+                default:
+                    invalid = true;
+            }
+            break;
+        default:
+            invalid = true;
+    }
+
+    if (invalid) {
+        invalid_count++;
+    }
+}
+
+void Chip8Batch::timers() {
+    for (size_t l = 0; l < lanes; l++) {
+        delay_timer[l] -= delay_timer[l] > 0;
+        sound_timer[l] -= sound_timer[l] > 0;
+    }
+}
+
+void Chip8Batch::step() {
+    // (fetch phase) one opcode per lane. memory is interleaved by address,
+    // so when all lanes sit on the same pc both opcode bytes are contiguous rows.
+    bool same_pc = true;
+    for (size_t l = 0; l < lanes; l++) {
+        same_pc &= pc[l] == pc[0];
+    }
+
+    bool uniform = true;
+    if (same_pc) {
+        const uint8_t *hi = &mem[(pc[0] & (MEM_SIZE - 1)) * lanes];
+        const uint8_t *lo = &mem[((pc[0] + 1) & (MEM_SIZE - 1)) * lanes];
+        for (size_t l = 0; l < lanes; l++) {
+            opcodes[l] = (hi[l] << 8) | lo[l];
+            uniform &= opcodes[l] == opcodes[0];
+        }
+    } else {
+        for (size_t l = 0; l < lanes; l++) {
+            opcodes[l] = (mem[(pc[l] & (MEM_SIZE - 1)) * lanes + l] << 8)
+                       | mem[((pc[l] + 1) & (MEM_SIZE - 1)) * lanes + l];
+            uniform &= opcodes[l] == opcodes[0];
+        }
+    }
+    for (size_t l = 0; l < lanes; l++) {
+        pc[l] += 2;
+    }
+
+    // (decode and execute phase)
+    if (uniform) {
+        execute(opClass(opcodes[0]), AllLanes{lanes, opcodes[0]});
+    } else {
+        // counting sort of the lanes by opcode class, then one kernel per class.
+        size_t start[NUM_CLASSES + 1] = {};
+        for (size_t l = 0; l < lanes; l++) {
+            start[opClass(opcodes[l]) + 1]++;
+        }
+        for (int c = 0; c < NUM_CLASSES; c++) {
+            start[c + 1] += start[c];
+        }
+        size_t fill[NUM_CLASSES];
+        std::copy(start, start + NUM_CLASSES, fill);
+        for (size_t l = 0; l < lanes; l++) {
+            order[fill[opClass(opcodes[l])]++] = l;
+        }
+        for (int c = 0; c < NUM_CLASSES; c++) {
+            if (start[c + 1] > start[c]) {
+                execute(c, LaneList{&order[start[c]], start[c + 1] - start[c], opcodes.data()});
+            }
+        }
+    }
+}
+
+void Chip8Batch::run(uint64_t cycles) {
+    for (uint64_t i = 0; i < cycles; i++) {
+        step();
+    }
+}
+
+size_t Chip8Batch::size() const {
+    return lanes;
+}
+
+uint8_t* Chip8Batch::keyPad(size_t lane) {
+    return &keys[lane * NUM_KEYS];
+}
+
+const uint64_t* Chip8Batch::getGraphics(size_t lane) const {
+    return &graphics[lane * SCREEN_HEIGHT];
+}
+
+uint8_t Chip8Batch::getRegister(size_t lane, int reg) const {
+    return v[reg * lanes + lane];
+}
+
+uint16_t Chip8Batch::getIndex(size_t lane) const {
+    return index[lane];
+}
+
+uint16_t Chip8Batch::getPC(size_t lane) const {
+    return pc[lane];
+}
+
+uint8_t Chip8Batch::getSP(size_t lane) const {
+    return sp[lane];
+}
+
+uint8_t Chip8Batch::getDelayTimer(size_t lane) const {
+    return delay_timer[lane];
+}
+
+uint8_t Chip8Batch::getSoundTimer(size_t lane) const {
+    return sound_timer[lane];
+}
+
+uint64_t Chip8Batch::getInvalidCount() const {
+    return invalid_count;
+}
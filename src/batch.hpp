@@ -0,0 +1,65 @@
+#ifndef CHIPS_BATCH
+#define CHIPS_BATCH
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "chip8.hpp"
+
+// steps N independent chip-8 machines in lockstep.
+//
+// the state is kept struct-of-arrays: register Vx of every lane sits in one
+// contiguous column (v[x * lanes + lane]), same for pc, index, sp and the
+// timers. each step fetches one opcode per lane, then groups the lanes by
+// opcode class and runs each class as one tight loop over its lanes, so the
+// ALU/skip kernels get auto-vectorized. when every lane is on the same opcode
+// (the usual case when all lanes run the same rom) the kernel runs straight
+// over the columns without any gather.
+class Chip8Batch {
+private:
+    size_t lanes;
+
+    std::vector<uint8_t> v;           // v[reg * lanes + lane]
+    std::vector<uint16_t> stack;      // stack[level * lanes + lane]
+    std::vector<uint16_t> index;
+    std::vector<uint16_t> pc;
+    std::vector<uint8_t> sp;
+    std::vector<uint8_t> delay_timer;
+    std::vector<uint8_t> sound_timer;
+    std::vector<uint64_t> rng;        // per lane pcg state for Cxkk, see rng.hpp
+    std::vector<uint8_t> mem;         // mem[addr * lanes + lane]
+    std::vector<uint64_t> graphics;   // graphics[lane * SCREEN_HEIGHT + row], packed like Chip8
+    std::vector<uint8_t> keys;        // keys[lane * NUM_KEYS + key]
+
+    // scratch space for one step.
+    std::vector<uint16_t> opcodes;
+    std::vector<uint32_t> order;      // lane ids sorted by opcode class
+    uint64_t invalid_count;
+
+    template <typename Lanes>
+    void execute(int op_class, const Lanes &lanes);
+    void executeScalar(size_t lane, uint16_t opcode);
+public:
+    explicit Chip8Batch(size_t lanes);
+
+    bool loadRom(const std::string& rom_file); // loads the same rom into every lane
+    void step(); // one cycle on every lane
+    void run(uint64_t cycles);
+    void timers(); // one 60 Hz timer tick on every lane
+    void setSeed(uint64_t seed); // lane i gets seed + i, same sequence as a Chip8 with that seed
+
+    size_t size() const;
+    uint8_t* keyPad(size_t lane);
+    const uint64_t* getGraphics(size_t lane) const;
+    uint8_t getRegister(size_t lane, int reg) const;
+    uint16_t getIndex(size_t lane) const;
+    uint16_t getPC(size_t lane) const;
+    uint8_t getSP(size_t lane) const;
+    uint8_t getDelayTimer(size_t lane) const;
+    uint8_t getSoundTimer(size_t lane) const;
+    uint64_t getInvalidCount() const;
+};
+
+#endif
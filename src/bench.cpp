@@ -0,0 +1,426 @@
+// chips-bench: microbenchmarks for the core, in the spirit of google
+// benchmark (each body runs until it has taken at least --min-time).
+//
+//  dispatch/*  synthetic roms, alu-only, branch-heavy and memory-heavy
+//  draw/*      Dxyn at heights 1, 5 and 15, byte aligned, unaligned and wrapping
+//  rom/*       full frames of every rom in roms/ with a scripted input
+//  load/*      putting a rom into a machine: from the file, or a reset from RomCache
+//  fork/*      Chip8::fork() against a full copy through a Chip8State, alone and
+//              followed by one frame on the child
+//  display/*   packed display to 32-bit pixels (expandDisplay)
+//
+// instr/s counts emulated instructions, ns/frame is per 1/60 s frame at
+// DEFAULT_IPS. idle fast-forward is off in every machine here, so each
+// instruction counted was executed and the numbers stay comparable with
+// runs from before it existed. use it as the baseline before and after a change, the
+// numbers only mean something relative to each other on the same box.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <filesystem>
+#include <algorithm>
+#include <cstdlib>
+
+#include "chip8.hpp"
+#include "scheduler.hpp"
+#include "display.hpp"
+#include "romcache.hpp"
+
+#ifndef CHIPS_ROM_DIR
+#define CHIPS_ROM_DIR "roms"
+#endif
+
+#define BENCH_CHUNK 1000 // instructions per iteration of the dispatch/draw benchmarks
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// bodies set up outside the timed part and bracket the loop with start/stop.
+struct Timer {
+    Clock::time_point begin;
+    double secs = 0;
+
+    void start() { begin = Clock::now(); }
+    void stop() { secs += std::chrono::duration<double>(Clock::now() - begin).count(); }
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<uint64_t(uint64_t iterations, Timer &timer)> body; // returns instructions run
+    bool frames; // an iteration is one frame
+};
+
+// tells the optimizer the memory at p is read, so the stores that filled
+// it can't be dropped. compiles to nothing.
+inline void escape(const void *p) {
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+// alu only, a straight block of 8xyN/6xkk/7xkk ending in a jump back.
+const uint8_t ALU_ROM[] = {
+    0x60, 0x01, // 200: LD V0, 1
+    0x61, 0x03, // 202: LD V1, 3
+    0x80, 0x14, // 204: ADD V0, V1
+    0x81, 0x03, // 206: XOR V1, V0
+    0x82, 0x01, // 208: OR V2, V0
+    0x83, 0x16, // 20a: SHR V3, V1
+    0x74, 0x05, // 20c: ADD V4, 5
+    0x84, 0x25, // 20e: SUB V4, V2
+    0x85, 0x0E, // 210: SHL V5, V0
+    0x86, 0x52, // 212: AND V6, V5
+    0x12, 0x04, // 214: JP 204
+};
+
+// short loops, taken and not taken skips, a call and a return.
+const uint8_t BRANCH_ROM[] = {
+    0x60, 0x00, // 200: LD V0, 0
+    0x70, 0x01, // 202: ADD V0, 1
+    0x30, 0x10, // 204: SE V0, 10
+    0x12, 0x02, // 206: JP 202
+    0x71, 0x01, // 208: ADD V1, 1
+    0x50, 0x10, // 20a: SE V0, V1
+    0x90, 0x10, // 20c: SNE V0, V1
+    0x22, 0x14, // 20e: CALL 214
+    0x60, 0x00, // 210: LD V0, 0
+    0x12, 0x02, // 212: JP 202
+    0x00, 0xEE, // 214: RET
+};
+
+// register dumps and loads, bcd and I arithmetic over a scratch area.
+const uint8_t MEMORY_ROM[] = {
+    0x60, 0x01, // 200: LD V0, 1
+    0xA3, 0x00, // 202: LD I, 300
+    0xF7, 0x55, // 204: LD [I], V7
+    0xF7, 0x65, // 206: LD V7, [I]
+    0xF0, 0x33, // 208: LD B, V0
+    0xF0, 0x1E, // 20a: ADD I, V0
+    0x70, 0x01, // 20c: ADD V0, 1
+    0x30, 0x0A, // 20e: SE V0, 0a
+    0x12, 0x04, // 210: JP 204
+    0x12, 0x00, // 212: JP 200
+};
+
+// one sprite of the given height from the font area, drawn over and over.
+std::vector<uint8_t> drawRom(int x, int y, int height) {
+    return {
+        0xA0, 0x50,                           // 200: LD I, 50
+        0x60, uint8_t(x),                     // 202: LD V0, x
+        0x61, uint8_t(y),                     // 204: LD V1, y
+        0xD0, uint8_t(0x10 | height),         // 206: DRW V0, V1, height
+        0x12, 0x06,                           // 208: JP 206
+    };
+}
+
+uint64_t runChunks(const uint8_t *rom, size_t size, Chip8::Backend backend, uint64_t iterations, Timer &timer) {
+    Chip8 *chips = new Chip8();
+    chips->setQuiet(true);
+    chips->setBackend(backend);
+    chips->setFastForward(false);
+    chips->loadRom({rom, size});
+    chips->run(BENCH_CHUNK); // warm the decode cache and the jit
+
+    timer.start();
+    for (uint64_t i = 0; i < iterations; i++) {
+        chips->run(BENCH_CHUNK);
+    }
+    timer.stop();
+
+    delete chips;
+    return iterations * BENCH_CHUNK;
+}
+
+// the same input every run: each key in turn, held for 10 frames with
+// 10 frames of nothing in between, so menus get through and games move.
+uint16_t scriptedKeys(uint64_t frame) {
+    uint64_t slot = frame / 10;
+    return slot % 2 ? 1u << ((slot / 2) % NUM_KEYS) : 0;
+}
+
+uint64_t runFrames(const std::vector<uint8_t> &rom, Chip8::Backend backend, uint64_t iterations, Timer &timer) {
+    Chip8 *chips = new Chip8();
+    chips->setQuiet(true);
+    chips->setBackend(backend);
+    chips->setFastForward(false);
+    chips->loadRom(rom);
+    Scheduler scheduler(chips, DEFAULT_IPS);
+    scheduler.setMode(Scheduler::Mode::Uncapped);
+
+    timer.start();
+    for (uint64_t frame = 0; frame < iterations; frame++) {
+        chips->setKeys(scriptedKeys(frame));
+        scheduler.runFrame();
+    }
+    timer.stop();
+
+    uint64_t cycles = scheduler.getCycleCount();
+    delete chips;
+    return cycles;
+}
+
+// a machine some way into a game, the parent for the fork/ benchmarks.
+std::unique_ptr<Chip8> playedMachine(const std::string &path) {
+    auto chips = std::make_unique<Chip8>();
+    chips->setQuiet(true);
+    chips->setFastForward(false); // forks inherit it
+    chips->loadRom(path);
+    Scheduler scheduler(chips.get(), DEFAULT_IPS);
+    scheduler.setMode(Scheduler::Mode::Uncapped);
+    for (uint64_t frame = 0; frame < 600; frame++) {
+        chips->setKeys(scriptedKeys(frame));
+        scheduler.runFrame();
+    }
+    return chips;
+}
+
+// the old way to branch off a machine: a new one loaded from a snapshot.
+std::unique_ptr<Chip8> fullCopy(const Chip8 &parent) {
+    Chip8State state;
+    parent.saveState(state);
+    auto chips = std::make_unique<Chip8>();
+    chips->setQuiet(true);
+    chips->setFastForward(false);
+    chips->loadState(state);
+    return chips;
+}
+
+uint64_t runOneFrame(Chip8 *chips) {
+    Scheduler scheduler(chips, DEFAULT_IPS);
+    scheduler.setMode(Scheduler::Mode::Uncapped);
+    scheduler.runFrame();
+    return scheduler.getCycleCount();
+}
+
+bool readRom(const std::filesystem::path &path, std::vector<uint8_t> &data) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !data.empty() && data.size() <= MEM_SIZE - START_ADDR;
+}
+
+void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [--filter SUBSTRING] [--min-time SECS] [--backend interp|cached|jit|aot]\n"
+              << "       [--rom-dir DIR]" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    double min_time = 0.1;
+    std::string rom_dir = CHIPS_ROM_DIR;
+    std::vector<Chip8::Backend> backends = {
+        Chip8::Backend::Interpreter, Chip8::Backend::Cached, Chip8::Backend::Jit, Chip8::Backend::Aot
+    };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            min_time = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--rom-dir" && i + 1 < argc) {
+            rom_dir = argv[++i];
+        } else if (arg == "--backend" && i + 1 < argc) {
+            Chip8::Backend backend;
+            if (!Chip8::parseBackend(argv[++i], backend)) {
+                usage(argv[0]);
+                return 1;
+            }
+            backends = {backend};
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Benchmark> benchmarks;
+
+    struct Synthetic {
+        const char *name;
+        const uint8_t *rom;
+        size_t size;
+    };
+    const Synthetic synthetic[] = {
+        {"alu", ALU_ROM, sizeof(ALU_ROM)},
+        {"branch", BRANCH_ROM, sizeof(BRANCH_ROM)},
+        {"memory", MEMORY_ROM, sizeof(MEMORY_ROM)},
+    };
+    for (const Synthetic &s : synthetic) {
+        for (Chip8::Backend backend : backends) {
+            if (backend == Chip8::Backend::Aot) {
+                continue; // only the roms in roms/ are translated
+            }
+            benchmarks.push_back({std::string("dispatch/") + s.name + "/" + Chip8::backendName(backend),
+                                  [s, backend](uint64_t n, Timer &t) { return runChunks(s.rom, s.size, backend, n, t); },
+                                  false});
+        }
+    }
+
+    struct Placement {
+        const char *name;
+        int x, y;
+    };
+    const Placement placements[] = {{"aligned", 8, 4}, {"unaligned", 13, 4}, {"wrap", 60, 28}};
+    for (int height : {1, 5, 15}) {
+        for (const Placement &p : placements) {
+            auto rom = std::make_shared<std::vector<uint8_t>>(drawRom(p.x, p.y, height));
+            Chip8::Backend backend = backends.size() == 1 ? backends[0] : Chip8::Backend::Cached;
+            benchmarks.push_back({"draw/h" + std::to_string(height) + "/" + p.name,
+                                  [rom, backend](uint64_t n, Timer &t) { return runChunks(rom->data(), rom->size(), backend, n, t); },
+                                  false});
+        }
+    }
+
+    std::vector<std::filesystem::path> rom_files;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(rom_dir, error)) {
+        if (entry.path().extension() == ".ch8") {
+            rom_files.push_back(entry.path());
+        }
+    }
+    std::sort(rom_files.begin(), rom_files.end());
+    if (rom_files.empty()) {
+        std::cerr << "no roms in " << rom_dir << ", skipping the rom/ benchmarks." << std::endl;
+    }
+    for (const auto &path : rom_files) {
+        auto rom = std::make_shared<std::vector<uint8_t>>();
+        if (!readRom(path, *rom)) {
+            std::cerr << "skipping " << path << std::endl;
+            continue;
+        }
+        for (Chip8::Backend backend : backends) {
+            benchmarks.push_back({"rom/" + path.filename().string() + "/" + Chip8::backendName(backend),
+                                  [rom, backend](uint64_t n, Timer &t) { return runFrames(*rom, backend, n, t); },
+                                  true});
+        }
+    }
+
+    if (!rom_files.empty()) {
+        std::string path = rom_files.front().string();
+        benchmarks.push_back({"load/file", [path](uint64_t n, Timer &t) {
+            Chip8 *chips = new Chip8();
+            t.start();
+            for (uint64_t i = 0; i < n; i++) {
+                chips->loadRom(path);
+            }
+            t.stop();
+            delete chips;
+            return uint64_t(0);
+        }, false});
+        benchmarks.push_back({"load/reset", [path](uint64_t n, Timer &t) {
+            std::shared_ptr<const RomImage> rom = RomCache::shared().load(path);
+            Chip8 *chips = new Chip8();
+            t.start();
+            for (uint64_t i = 0; i < n; i++) {
+                chips->reset(*rom);
+            }
+            t.stop();
+            delete chips;
+            return uint64_t(0);
+        }, false});
+
+        // forks are kept around until the timer stops, freeing them isn't
+        // part of what's measured.
+        auto forkBench = [path](bool cow, bool frame) {
+            return [path, cow, frame](uint64_t n, Timer &t) {
+                std::unique_ptr<Chip8> parent = playedMachine(path);
+                std::vector<std::unique_ptr<Chip8>> children(std::min<uint64_t>(n, 4096));
+                uint64_t instructions = 0;
+                t.start();
+                for (uint64_t i = 0; i < n; i++) {
+                    std::unique_ptr<Chip8> &child = children[i % children.size()];
+                    child = cow ? parent->fork() : fullCopy(*parent);
+                    if (frame) {
+                        instructions += runOneFrame(child.get());
+                    }
+                }
+                t.stop();
+                return instructions;
+            };
+        };
+        benchmarks.push_back({"fork/cow", forkBench(true, false), false});
+        benchmarks.push_back({"fork/copy", forkBench(false, false), false});
+        benchmarks.push_back({"fork/cow+frame", forkBench(true, true), true});
+        benchmarks.push_back({"fork/copy+frame", forkBench(false, true), true});
+    }
+
+    benchmarks.push_back({"display/expand", [](uint64_t n, Timer &t) {
+        // a busy screen, the cost doesn't depend on the contents anyway.
+        uint64_t graphics[SCREEN_HEIGHT];
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            graphics[y] = 0x9E3779B97F4A7C15ull * (y + 1);
+        }
+        std::vector<uint32_t> pixels(SCREEN_WIDTH * SCREEN_HEIGHT);
+        t.start();
+        for (uint64_t i = 0; i < n; i++) {
+            graphics[i % SCREEN_HEIGHT] ^= i; // keep the compiler from hoisting it
+            expandDisplay(graphics, pixels.data(), SCREEN_WIDTH * sizeof(uint32_t));
+            escape(pixels.data());
+        }
+        t.stop();
+        return uint64_t(0); // no instructions
+    }, true});
+
+    std::cout << std::left << std::setw(36) << "benchmark" << std::right
+              << std::setw(14) << "iterations" << std::setw(14) << "ns/iter"
+              << std::setw(16) << "instr/s" << std::setw(14) << "ns/frame" << '\n'
+              << std::string(94, '-') << '\n';
+
+    for (const Benchmark &bench : benchmarks) {
+        if (!filter.empty() && bench.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        // grow the iteration count until one run takes at least min_time.
+        uint64_t iterations = 1;
+        uint64_t instructions;
+        Timer timer;
+        for (;;) {
+            timer.secs = 0;
+            instructions = bench.body(iterations, timer);
+            if (timer.secs >= min_time || iterations >= (1ull << 40)) {
+                break;
+            }
+            double scale = timer.secs > 0 ? 1.4 * min_time / timer.secs : 100;
+            iterations = std::max<uint64_t>(iterations + 1, uint64_t(iterations * std::min(scale, 100.0)));
+        }
+
+        double ns = timer.secs * 1e9 / iterations;
+        std::cout << std::left << std::setw(36) << bench.name << std::right
+                  << std::setw(14) << iterations
+                  << std::setw(14) << std::fixed << std::setprecision(1) << ns;
+        if (instructions > 0) {
+            std::cout << std::setw(16) << std::setprecision(0) << instructions / timer.secs;
+        } else {
+            std::cout << std::setw(16) << "-";
+        }
+        if (bench.frames) {
+            std::cout << std::setw(14) << std::setprecision(1) << ns;
+        } else {
+            std::cout << std::setw(14) << "-";
+        }
+        std::cout << std::endl;
+    }
+
+    // what a fork costs to keep around, next to a full copy.
+    if (!rom_files.empty() && std::string("fork/memory").find(filter) != std::string::npos) {
+        std::unique_ptr<Chip8> parent = playedMachine(rom_files.front().string());
+        std::unique_ptr<Chip8> copy = fullCopy(*parent);
+        std::unique_ptr<Chip8> child = parent->fork();
+        size_t forked = child->footprint();
+        runOneFrame(child.get());
+        std::cout << "\nfork memory (" << rom_files.front().filename().string() << "): full copy "
+                  << copy->footprint() << " bytes, fork " << forked << " bytes, "
+                  << child->footprint() << " after one frame" << std::endl;
+    }
+    return 0;
+}
@@ -2,62 +2,164 @@
 #include <fstream>
 #include <iostream>
 #include <cstring>
+#include <atomic>
 
 #include "chip8.hpp"
+#include "jit.hpp"
+#include "aot.hpp"
+#include "audio.hpp"
+#include "profiler.hpp"
+#include "romcache.hpp"
+
+#ifdef CHIPS_FUZZ
+#define COVER(addr, opcode) if (coverage) cover(addr, opcode)
+#else
+#define COVER(addr, opcode)
+#endif
+
+#ifdef CHIPS_PROFILE
+#define PROFILE(call) if (profiler) profiler->call
+#else
+#define PROFILE(call)
+#endif
 
 Chip8::Chip8() {
     // set the default values for the interpreter components.
     std::memset(v, 0, NUM_REGS);
-    std::memset(stack, 0, STACK_SIZE);
-    std::copy(fonts, fonts + FONT_SIZE, mem + 0x50);
+    std::memset(stack, 0, sizeof(stack));
+    for (auto &page : pages) {
+        page = std::make_shared<Page>(); // zeroed, every slot OP_DECODE
+    }
+    owned_pages = ~0ull;
+    // the fonts run over a page boundary, a single copy would spill into the decode slots.
+    for (size_t i = 0; i < FONT_SIZE; i++) {
+        uint16_t addr = FONT_ADDR + i;
+        pages[addr / PAGE_SIZE]->bytes[addr % PAGE_SIZE] = fonts[i];
+    }
     index = 0;
     sp = -1; // set the stack pointer to -1 means empty.
     pc = START_ADDR;
     delay_timer = 0;
     sound_timer = 0;
-    std::memset(graphics, false, SCREEN_WIDTH * SCREEN_HEIGHT);
+    std::memset(graphics, 0, sizeof(graphics));
     std::memset(keys, false, NUM_KEYS);
+    setSeed(DEFAULT_SEED);
+    invalid_count = 0;
+    idle_cycles = 0;
+    stores = 0;
+    polled = false;
+    probe.left = 0;
+    fast_forward = true;
+    quiet = false;
+    display_dirty = true;
+    backend = Backend::Cached;
+    aot = nullptr;
+    aot_bound = false;
+    profiler = nullptr;
+    audio = nullptr;
+    ticks = 0;
+    sound_on = false;
+    coverage = nullptr;
 }
 
-bool Chip8::loadRom(const std::string& rom_file) {
-    std::fstream rom(rom_file, std::ios::in | std::ios::binary | std::ios::ate);
+Chip8::Chip8(const Chip8& parent) {
+    std::memcpy(v, parent.v, sizeof(v));
+    std::memcpy(stack, parent.stack, sizeof(stack));
+    std::memcpy(graphics, parent.graphics, sizeof(graphics));
+    std::memcpy(keys, parent.keys, sizeof(keys));
+    index = parent.index;
+    sp = parent.sp;
+    pc = parent.pc;
+    delay_timer = parent.delay_timer;
+    sound_timer = parent.sound_timer;
+    seed = parent.seed;
+    rng = parent.rng;
+    invalid_count = parent.invalid_count;
+    idle_cycles = parent.idle_cycles;
+    stores = parent.stores;
+    polled = false;
+    probe.left = 0;
+    fast_forward = parent.fast_forward;
+    quiet = parent.quiet;
+    display_dirty = parent.display_dirty;
+    std::copy(parent.pages, parent.pages + NUM_PAGES, pages);
+    owned_pages = 0;
+    parent.owned_pages = 0;
+    backend = parent.backend;
+    aot = parent.aot;
+    aot_bound = parent.aot_bound;
+    profiler = nullptr;
+    audio = nullptr;
+    ticks = parent.ticks;
+    sound_on = parent.sound_on;
+    coverage = nullptr;
+}
 
-    if (!rom) {
-        std::cerr << "failed to read rom file." << std::endl;
-        return false;
+std::unique_ptr<Chip8> Chip8::fork() const {
+    return std::unique_ptr<Chip8>(new Chip8(*this));
+}
+
+size_t Chip8::footprint() const {
+    size_t bytes = sizeof(Chip8);
+    for (size_t page = 0; page < NUM_PAGES; page++) {
+        if (ownsPage(page)) {
+            bytes += sizeof(Page);
+        }
     }
+    return bytes;
+}
 
-    const int FILE_SIZE = rom.tellg();
+Chip8::~Chip8() = default;
 
-    // check if the rom file is either too big or empty.
-    if (FILE_SIZE > sizeof(mem)/sizeof(mem[0])) {
-        std::cerr << "rom file is too big to load." << std::endl;
-        return false;
-    } else if (FILE_SIZE <= 0) {
-        std::cerr << "empty rom file detected..." << std::endl;
+bool Chip8::loadRom(const std::string& rom_file) {
+    // mapped, not read: the only copy is the one into mem.
+    RomFile rom(rom_file);
+    return rom.ok() && loadRom(rom.bytes());
+}
+
+bool Chip8::loadRom(std::span<const uint8_t> rom) {
+    if (!checkRomSize(rom.size())) {
         return false;
     }
 
-    char *data_buf = new char[FILE_SIZE];
-    rom.seekg(0);
-    rom.read(data_buf, FILE_SIZE); // read the contents of the file into the data_buf
-                                   // first arg - buffer, second arg - no of bytes to read in.
-    rom.close();
-
-    // starting address for the program is 512kb(0x200)
-    // with that offset, load the rom data.
-    std::copy(data_buf, data_buf + FILE_SIZE, mem+0x200);
-
-    delete[] data_buf; 
+    for (size_t i = 0; i < rom.size(); i++) {
+        uint16_t addr = START_ADDR + i;
+        ownPage(addr / PAGE_SIZE).bytes[addr % PAGE_SIZE] = rom[i];
+    }
+    flushDecodeCache();
+    if (jit) {
+        jit->flush();
+    }
+    aot_bound = false;
     return true;
 }
 
+void Chip8::reset(const RomImage& rom) {
+    replaceMem(rom.mem);
+    std::memset(v, 0, NUM_REGS);
+    std::memset(stack, 0, sizeof(stack));
+    index = 0;
+    sp = -1;
+    pc = START_ADDR;
+    delay_timer = 0;
+    sound_timer = 0;
+    std::memset(graphics, 0, sizeof(graphics));
+    std::memset(keys, false, NUM_KEYS);
+    rng = pcgSeed(seed);
+    invalid_count = 0;
+    idle_cycles = 0;
+    display_dirty = true;
+    aot_bound = false;
+    soundChanged();
+}
+
 uint16_t Chip8::pop() {
-    return stack[sp--]; // takes the top value from stack, decrement the sp then return. 
+    // sp wraps within the stack, an unbalanced rom can't reach past it.
+    return stack[sp-- % STACK_SIZE]; // takes the top value from stack, decrement the sp then return. 
 }
 
 void Chip8::push(const uint16_t data) {
-    stack[++sp] = data;
+    stack[++sp % STACK_SIZE] = data;
 }
 
 void Chip8::timers() {
@@ -65,12 +167,44 @@ void Chip8::timers() {
         --delay_timer;
     }
 
+    ticks++;
     if (sound_timer > 0) {
-        if (sound_timer == 1) {
-            std::cout << "BEEP!" << std::endl;
-            //TODO: beep
-        }
         --sound_timer;
+        if (sound_timer == 0) {
+            soundChanged();
+        }
+    }
+    if (audio) {
+        audio->now.store(ticks, std::memory_order_release);
+    }
+}
+
+void Chip8::soundChanged() {
+    bool on = sound_timer > 0;
+    if (on != sound_on) {
+        sound_on = on;
+        if (audio) {
+            // a full queue means nobody is playing them, the edge is lost.
+            audio->edges.push({ticks, on});
+        }
+    }
+}
+
+void Chip8::setCoverage(uint8_t *map) {
+    coverage = map;
+}
+
+void Chip8::cover(uint16_t addr, uint16_t opcode) {
+    uint8_t &hit = coverage[addr & (MEM_SIZE - 1)];
+    hit += hit != UINT8_MAX;
+    uint8_t &op = coverage[MEM_SIZE + Profiler::classify(opcode)];
+    op += op != UINT8_MAX;
+}
+
+void Chip8::setAudio(AudioQueue *q) {
+    audio = q;
+    if (audio) {
+        audio->now.store(ticks, std::memory_order_release);
     }
 }
 
@@ -78,25 +212,314 @@ bool* Chip8::keyPad() {
     return keys;
 }
 
-bool* Chip8::getGraphics() {
+void Chip8::setKeys(uint16_t mask) {
+    for (int i = 0; i < NUM_KEYS; i++) {
+        keys[i] = (mask >> i) & 1;
+    }
+}
+
+uint16_t Chip8::getKeys() const {
+    uint16_t mask = 0;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        mask |= uint16_t(keys[i]) << i;
+    }
+    return mask;
+}
+
+void Chip8::setSeed(uint64_t new_seed) {
+    seed = new_seed;
+    rng = pcgSeed(seed);
+}
+
+uint64_t Chip8::getSeed() const {
+    return seed;
+}
+
+void Chip8::setQuiet(bool q) {
+    quiet = q;
+}
+
+uint64_t Chip8::getInvalidCount() const {
+    return invalid_count;
+}
+
+void Chip8::setFastForward(bool on) {
+    fast_forward = on;
+}
+
+uint64_t Chip8::getIdleCycles() const {
+    return idle_cycles;
+}
+
+const uint64_t* Chip8::getGraphics() const {
     return graphics;
 }
 
-void Chip8::cycle() {
+bool Chip8::displayDirty() const {
+    return display_dirty;
+}
+
+void Chip8::clearDisplayDirty() {
+    display_dirty = false;
+}
+
+const uint8_t* Chip8::getRegisters() const {
+    return v;
+}
+
+const uint16_t* Chip8::getStack() const {
+    return stack;
+}
+
+uint16_t Chip8::getIndex() const {
+    return index;
+}
+
+uint16_t Chip8::getPC() const {
+    return pc;
+}
+
+uint8_t Chip8::getSP() const {
+    return sp;
+}
+
+uint8_t Chip8::getDelayTimer() const {
+    return delay_timer;
+}
+
+uint8_t Chip8::getSoundTimer() const {
+    return sound_timer;
+}
+
+void Chip8::drawSprite(uint8_t x_pos, uint8_t y_pos, uint8_t height) {
+    // if the (x, y) gets outside the 64x32 it will get wrapped around.
+    // height tells how tall or the number of rows.
+    //
+    // each sprite row is rotated into place and xor'ed onto the screen row
+    // in one go, any bit set in both means a pixel got flipped off.
+    uint8_t rows[16]; // n is a nibble
+    readMem(index, rows, height);
+    uint64_t flipped = 0;
+    for (int y_dir = 0; y_dir < height; y_dir++) {
+        uint64_t sprite = spriteRow(rows[y_dir], x_pos);
+        uint64_t &row = graphics[(y_pos + y_dir) % SCREEN_HEIGHT];
+        flipped |= row & sprite;
+        row ^= sprite;
+    }
+    v[0xF] = flipped != 0;
+    display_dirty = true;
+    stores++;
+}
+
+bool Chip8::ownsPage(size_t page) const {
+    if (owned_pages >> page & 1) {
+        return true;
+    }
+    if (pages[page].use_count() != 1) {
+        return false;
+    }
+    // pairs with the release in the other owner's shared_ptr drop, whatever
+    // it did with the page is done before this side writes to it. (tsan
+    // doesn't model fences and reports this as a race.)
+    std::atomic_thread_fence(std::memory_order_acquire);
+    owned_pages |= 1ull << page;
+    return true;
+}
+
+Chip8::Page& Chip8::ownPage(size_t page) {
+    if (!ownsPage(page)) {
+        pages[page] = std::make_shared<Page>(*pages[page]);
+        owned_pages |= 1ull << page;
+    }
+    return *pages[page];
+}
+
+void Chip8::dropDecoded(uint16_t addr) {
+    addr &= MEM_SIZE - 1;
+    // an empty slot stays empty, no need to copy a shared page for it.
+    if (pages[addr / PAGE_SIZE]->decoded[addr % PAGE_SIZE].op != OP_DECODE) {
+        ownPage(addr / PAGE_SIZE).decoded[addr % PAGE_SIZE].op = OP_DECODE;
+    }
+}
+
+void Chip8::readMem(uint16_t addr, uint8_t *out, uint16_t len) const {
+    for (uint16_t done = 0; done < len;) {
+        uint16_t a = (addr + done) & (MEM_SIZE - 1);
+        size_t offset = a % PAGE_SIZE;
+        size_t n = std::min<size_t>(len - done, PAGE_SIZE - offset);
+        std::memcpy(out + done, pages[a / PAGE_SIZE]->bytes + offset, n);
+        done += n;
+    }
+}
+
+void Chip8::writeMem(uint16_t addr, const uint8_t *data, uint16_t len) {
+    stores++;
+    for (uint16_t done = 0; done < len;) {
+        uint16_t a = (addr + done) & (MEM_SIZE - 1);
+        size_t offset = a % PAGE_SIZE;
+        size_t n = std::min<size_t>(len - done, PAGE_SIZE - offset);
+        Page &page = ownPage(a / PAGE_SIZE);
+        std::memcpy(page.bytes + offset, data + done, n);
+
+        // the instructions starting at a byte and at the one before it both cover it.
+        for (size_t i = 0; i < n; i++) {
+            page.decoded[offset + i].op = OP_DECODE;
+        }
+        if (offset > 0) {
+            page.decoded[offset - 1].op = OP_DECODE;
+        } else {
+            dropDecoded(a - 1);
+        }
+        if (jit) {
+            jit->invalidate(a, n);
+        }
+        if (aot) {
+            for (size_t i = 0; i < n; i++) {
+                if (aot->covered[a + i]) {
+                    aot = nullptr; // self-modifying code, the decode cache takes over
+                    break;
+                }
+            }
+        }
+        done += n;
+    }
+}
+
+void Chip8::flushDecodeCache() {
+    for (size_t addr = 0; addr < MEM_SIZE; addr++) {
+        dropDecoded(addr);
+    }
+}
+
+void Chip8::invalidateRange(uint16_t addr, uint16_t len) {
+    for (uint16_t i = 0; i < len; i++) {
+        uint16_t a = (addr + i) & (MEM_SIZE - 1);
+        dropDecoded(a);
+        dropDecoded(a - 1);
+        if (jit) {
+            jit->invalidate(a);
+        }
+        if (aot && aot->covered[a]) {
+            aot = nullptr;
+        }
+    }
+}
+
+void Chip8::saveState(Chip8State& state) const {
+    state.magic = STATE_MAGIC;
+    state.version = STATE_VERSION;
+    copyMemory(state.mem);
+    std::memcpy(state.graphics, graphics, sizeof(graphics));
+    state.seed = seed;
+    state.rng = rng;
+    std::memcpy(state.stack, stack, sizeof(stack));
+    std::memcpy(state.v, v, sizeof(v));
+    for (int i = 0; i < NUM_KEYS; i++) {
+        state.keys[i] = keys[i];
+    }
+    state.index = index;
+    state.pc = pc;
+    state.sp = sp;
+    state.delay_timer = delay_timer;
+    state.sound_timer = sound_timer;
+    std::memset(state.reserved, 0, sizeof(state.reserved));
+}
+
+void Chip8::replaceMem(const uint8_t *image) {
+    // compare a word at a time and only invalidate the code under the words
+    // that changed. a restore to a nearby state usually touches a handful of
+    // bytes, so the decode cache and jit blocks survive it.
+    const size_t WORD = sizeof(uint64_t);
+    for (size_t addr = 0; addr < MEM_SIZE; addr += WORD) {
+        uint64_t now, then;
+        std::memcpy(&now, pages[addr / PAGE_SIZE]->bytes + addr % PAGE_SIZE, WORD);
+        std::memcpy(&then, image + addr, WORD);
+        if (now != then) {
+            std::memcpy(ownPage(addr / PAGE_SIZE).bytes + addr % PAGE_SIZE, image + addr, WORD);
+            invalidateRange(addr, WORD);
+        }
+    }
+}
+
+bool Chip8::loadState(const Chip8State& state) {
+    if (state.magic != STATE_MAGIC || state.version != STATE_VERSION) {
+        if (!quiet) {
+            std::cerr << "not a chips state, or from another version." << std::endl;
+        }
+        return false;
+    }
+
+    replaceMem(state.mem);
+    std::memcpy(graphics, state.graphics, sizeof(graphics));
+    display_dirty = true;
+    seed = state.seed;
+    rng = state.rng;
+    std::memcpy(stack, state.stack, sizeof(stack));
+    std::memcpy(v, state.v, sizeof(v));
+    for (int i = 0; i < NUM_KEYS; i++) {
+        keys[i] = state.keys[i] != 0;
+    }
+    index = state.index;
+    pc = state.pc;
+    sp = state.sp;
+    delay_timer = state.delay_timer;
+    sound_timer = state.sound_timer;
+    aot_bound = false;
+    soundChanged();
+    return true;
+}
+
+bool Chip8::saveState(const std::string& state_file) const {
+    Chip8State state;
+    saveState(state);
+
+    std::ofstream out(state_file, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&state), sizeof(state));
+    if (!out) {
+        if (!quiet) {
+            std::cerr << "failed to write state file." << std::endl;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool Chip8::loadState(const std::string& state_file) {
+    std::ifstream in(state_file, std::ios::in | std::ios::binary);
+    Chip8State state;
+    in.read(reinterpret_cast<char*>(&state), sizeof(state));
+    if (!in) {
+        if (!quiet) {
+            std::cerr << "failed to read state file." << std::endl;
+        }
+        return false;
+    }
+    return loadState(state);
+}
+
+bool Chip8::interpret() {
     // (fetch phase)
     // for 16 bit opcode. read 8 bits from the current pc
     // and another 8 bits from the pc+1
-    uint16_t opcode = (mem[pc] << 8) | mem[pc+1];
+    uint16_t opcode = fetchOpcode(pc);
+    PROFILE(record(pc, opcode));
+    COVER(pc, opcode);
     pc += 2;
+    return execute(opcode);
+}
 
+bool Chip8::execute(uint16_t opcode) {
     bool invalid = false;
+    bool may_idle = false;
 
     // (decode and execute phase)
     switch (opcode & 0xF000) {
         case 0x0000:
             switch (opcode & 0x00FF) {
                 case 0x00E0: //clear the screen 
-                    std::memset(graphics, false, SCREEN_WIDTH * SCREEN_HEIGHT);
+                    std::memset(graphics, 0, sizeof(graphics));
+                    display_dirty = true;
+                    stores++;
                     break;
                 case 0x00EE: // return from a subroutine
                     pc = pop();
@@ -107,6 +530,8 @@ void Chip8::cycle() {
             break;
         case 0x1000: // goto NNN (like jump unconditionally.)
             // take the lowest three nibbles and set it to current pc
+            // a jump to itself, or the end of a loop that polled something.
+            may_idle = polled || (opcode & 0x0FFF) == pc - 2;
             pc = opcode & 0x0FFF;
             break;
         case 0x2000: // function call 
@@ -196,57 +621,27 @@ void Chip8::cycle() {
         case 0xA000: // set index to address nnn
             index = (opcode & 0x0FFF);
             break;
-        case 0xB000: // jump to address nnn + V0
-            pc = (opcode & 0x0FFF) + v[0];
+        case 0xB000: // jump to address nnn + V0, wrapped to the address space
+            pc = ((opcode & 0x0FFF) + v[0]) & (MEM_SIZE - 1);
             break;
         case 0xC000: // perform AND with random byte and nn and store result in Vx
-            srand(time(nullptr));
-            v[(opcode & 0x0F00) >> 8] = ((rand() % UINT8_MAX) & (opcode & 0x00FF));
+            v[(opcode & 0x0F00) >> 8] = (pcgNext(rng) >> 24) & (opcode & 0x00FF);
             break;
-        case 0xD000: { // display the sprite at the location Vx, Vy
-            // if the (x, y) gets outside the 64x32 it will get wrapped around.
-            uint8_t x_pos = v[(opcode & 0x0F00) >> 8];
-            uint8_t y_pos = v[(opcode & 0x00F0) >> 4];
-            uint8_t height = (opcode & 0x000F); // this tells how tall or the number of rows.
-
-            // dir means direction not directory atleast here.
-            //     col(x_dir)
-            // ------------------
-            // |                |
-            // |                | row(y_dir)
-            // |                |
-            // ------------------
-
-            bool is_flip = false;
-            for (int y_dir = 0; y_dir < height; y_dir++) {
-                uint8_t pixels = mem[index + y_dir];
-                for (int x_dir = 0; x_dir < 8; x_dir++) {
-                    if (pixels & (0x80 >> x_dir)) {
-                        auto x = (x_pos + x_dir) % SCREEN_WIDTH;
-                        auto y = (y_pos + y_dir) % SCREEN_HEIGHT;
-
-                        auto idx = x + SCREEN_WIDTH * y;
-                        is_flip |= graphics[idx];
-                        graphics[idx] ^= true;
-                    }
-                }
-            }
-            if (is_flip)
-                v[0xF] = 1;
-            else
-                v[0xF] = 0;
+        case 0xD000: // display the sprite at the location Vx, Vy
+            drawSprite(v[(opcode & 0x0F00) >> 8], v[(opcode & 0x00F0) >> 4], opcode & 0x000F);
             break;
-        }
         case 0xE000:
             switch (opcode & 0x00FF) {
                 // TODO: check for correctness
                 case 0x009E: // skip next instruction if key stored in Vx is pressed. 
-                    if (keys[v[(opcode & 0x0F00) >> 8]]) 
+                    if (keys[v[(opcode & 0x0F00) >> 8] % NUM_KEYS]) 
                         pc += 2;
+                    polled = true;
                     break;
                 case 0x00A1: // skip an instruction if the key stored in Vx is not pressed
-                    if (!keys[v[(opcode & 0x0F00) >> 8]])
+                    if (!keys[v[(opcode & 0x0F00) >> 8] % NUM_KEYS])
                         pc += 2; 
+                    polled = true;
                     break;
                 default:
                     invalid = true;
@@ -256,6 +651,7 @@ void Chip8::cycle() {
             switch (opcode & 0x00FF) {
                 case 0x0007: // set Vx = delay_timer
                     v[(opcode & 0x0F00) >> 8] = delay_timer;
+                    polled = true;
                     break;
                 case 0x000A: { // wait for the keypress and store the value of key in Vx
                     // TODO: check for correctness.
@@ -264,7 +660,7 @@ void Chip8::cycle() {
                     // iterate through the elements in the 'keys' 
                     // if the key is pressed set the flag(pressed) to true
                     // and set the value of current index to the Vx; 
-                    for (int i = 0; i < UINT8_MAX; i++) {
+                    for (int i = 0; i < NUM_KEYS; i++) {
                         if (keys[i]) {
                             pressed = true;
                             v[(opcode & 0x0F00) >> 8] = i;
@@ -273,8 +669,10 @@ void Chip8::cycle() {
                     }
 
                     // if the key is not pressed, repeat the same instruction
-                    if (!pressed) 
+                    if (!pressed) {
                         pc -= 2;
+                        may_idle = true;
+                    }
                     break;
                 }
                 case 0x0015: // set DT to Vx
@@ -282,6 +680,7 @@ void Chip8::cycle() {
                     break;
                 case 0x0018: // set ST to Vx
                     sound_timer = v[(opcode & 0x0F00) >> 8];
+                    soundChanged();
                     break;
                 case 0x001E: // I = I + Vx
                     // TODO: check if need to add overflow check constraint index += v[(opcode & 0x0F00 >> 8)];
@@ -291,25 +690,22 @@ void Chip8::cycle() {
                              // for digit in Vx
                     // font sprites starts from 0x50 in the memory
                     // each sprite is 5 bytes long.
-                    index = 0x050 + (v[(opcode & 0x0F00) >> 8] * 0x5) ;
+                    index = FONT_ADDR + (v[(opcode & 0x0F00) >> 8] * 0x5) ;
                     break;
-                case 0x0033: // store BCD representation of Vx in the memory  
-                    mem[index] = v[(opcode & 0x0F00) >> 8] / 100;
-                    mem[index + 1] = (v[(opcode & 0x0F00) >> 8] % 100) / 10;
-                    mem[index + 2] = (v[(opcode & 0x0F00) >> 8]) % 10;
+                case 0x0033: { // store BCD representation of Vx in the memory  
+                    uint8_t vx = v[(opcode & 0x0F00) >> 8];
+                    uint8_t bcd[3] = {uint8_t(vx / 100), uint8_t((vx % 100) / 10), uint8_t(vx % 10)};
+                    writeMem(index, bcd, 3);
                     break;
+                }
                 case 0x0055: { // store registers V0 - Vx in memory at index
                     uint8_t x = (opcode & 0xF00) >> 8;
-                    for (int idx = 0; idx <= x; idx++) {
-                        mem[index + idx] = v[idx];
-                    }
+                    writeMem(index, v, x + 1);
                     break;
                 }
                 case 0x0065: { // load V0 - Vx with values from the memory at index
                     uint8_t x = (opcode & 0xF00) >> 8;
-                    for (int idx = 0; idx <= x; idx++) {
-                        v[idx] = mem[index + idx];
-                    }
+                    readMem(index, v, x + 1);
                     break;
                 }
                 default:
@@ -321,8 +717,502 @@ void Chip8::cycle() {
     }
 
     if (invalid) {
-        std::cerr << "Invalid Opcode: " << std::hex << opcode << std::endl;
+        invalid_count++;
+        if (!quiet) {
+            std::cerr << "Invalid Opcode: " << std::hex << opcode << std::dec << std::endl;
+        }
+    }
+    return may_idle;
+}
+
+Chip8::IdleProbe Chip8::takeProbe(uint64_t left) const {
+    IdleProbe p;
+    p.left = left;
+    p.rng = rng;
+    p.invalid_count = invalid_count;
+    p.stores = stores;
+    p.pc = pc;
+    p.index = index;
+    std::memcpy(p.stack, stack, sizeof(stack));
+    std::memcpy(p.v, v, sizeof(v));
+    p.sp = sp;
+    p.delay_timer = delay_timer;
+    p.sound_timer = sound_timer;
+    return p;
+}
+
+uint64_t Chip8::skipIdle(uint64_t left) {
+    // the timers and keys only change between run() calls, so a loop that
+    // waits on them can't get anywhere before this one ends. run out the
+    // budget, or the whole iterations of it, without executing anything.
+    if (!fast_forward || left == 0) {
+        return 0;
+    }
+#ifdef CHIPS_PROFILE
+    if (profiler) {
+        return 0; // the profile shows every instruction the guest runs
     }
+#endif
+
+    uint16_t opcode = fetchOpcode(pc);
+    uint64_t skip = 0;
+    if ((opcode & 0xF0FF) == 0xF00A) {
+        // Fx0A with nothing down rewinds pc and does nothing else.
+        if (getKeys() == 0) {
+            skip = left;
+        }
+    } else if (opcode == (0x1000 | pc)) {
+        skip = left;
+    } else if (polled) {
+        // a loop reading the delay timer or keys. the first time round only
+        // leaves a probe, the next one at the same pc tells whether it got
+        // anywhere. nothing stored and the same registers means the machine
+        // is exactly where it was, so it will be again every period cycles.
+        polled = false;
+        IdleProbe now = takeProbe(left);
+        if (probe.left == 0 || probe.left - left > IDLE_MAX_PERIOD) {
+            probe = now; // none yet, or taken too long ago to be this loop's
+        } else if (probe.pc == pc) {
+            uint64_t period = probe.left - left;
+            now.left = probe.left;
+            if (now == probe) {
+                skip = left / period * period;
+            } else {
+                probe = takeProbe(left);
+            }
+        }
+    }
+    if (skip > 0) {
+        probe.left = 0;
+    }
+    idle_cycles += skip;
+    return skip;
+}
+
+Chip8::Instr Chip8::decode(uint16_t opcode) {
+    Instr ins;
+    ins.x = (opcode & 0x0F00) >> 8;
+    ins.y = (opcode & 0x00F0) >> 4;
+    ins.n = opcode & 0x000F;
+    ins.kk = opcode & 0x00FF;
+    ins.nnn = opcode & 0x0FFF;
+    ins.op = OP_INVALID;
+
+    // same decoding as interpret(), done once per address instead of per cycle.
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (ins.kk == 0xE0) ins.op = OP_CLS;
+            else if (ins.kk == 0xEE) ins.op = OP_RET;
+            break;
+        case 0x1000: ins.op = OP_JP; break;
+        case 0x2000: ins.op = OP_CALL; break;
+        case 0x3000: ins.op = OP_SE_IMM; break;
+        case 0x4000: ins.op = OP_SNE_IMM; break;
+        case 0x5000: ins.op = OP_SE_REG; break;
+        case 0x6000: ins.op = OP_LD_IMM; break;
+        case 0x7000: ins.op = OP_ADD_IMM; break;
+        case 0x8000:
+            switch (ins.n) {
+                case 0x0: ins.op = OP_LD_REG; break;
+                case 0x1: ins.op = OP_OR; break;
+                case 0x2: ins.op = OP_AND; break;
+                case 0x3: ins.op = OP_XOR; break;
+                case 0x4: ins.op = OP_ADD_REG; break;
+                case 0x5: ins.op = OP_SUB; break;
+                case 0x6: ins.op = OP_SHR; break;
+                case 0x7: ins.op = OP_SUBN; break;
+                case 0xE: ins.op = OP_SHL; break;
+            }
+            break;
+        case 0x9000: ins.op = OP_SNE_REG; break;
+        case 0xA000: ins.op = OP_LD_I; break;
+        case 0xB000: ins.op = OP_JP_V0; break;
+        case 0xC000: ins.op = OP_RND; break;
+        case 0xD000: ins.op = OP_DRW; break;
+        case 0xE000:
+            if (ins.kk == 0x9E) ins.op = OP_SKP;
+            else if (ins.kk == 0xA1) ins.op = OP_SKNP;
+            break;
+        case 0xF000:
+            switch (ins.kk) {
+                case 0x07: ins.op = OP_LD_VX_DT; break;
+                case 0x0A: ins.op = OP_LD_VX_K; break;
+                case 0x15: ins.op = OP_LD_DT_VX; break;
+                case 0x18: ins.op = OP_LD_ST_VX; break;
+                case 0x1E: ins.op = OP_ADD_I; break;
+                case 0x29: ins.op = OP_LD_F; break;
+                case 0x33: ins.op = OP_LD_B; break;
+                case 0x55: ins.op = OP_LD_MEM_VX; break;
+                case 0x65: ins.op = OP_LD_VX_MEM; break;
+            }
+            break;
+    }
+    return ins;
+}
+
+uint64_t Chip8::runCached(uint64_t cycles, const AotTable *stop) {
+    // computed goto, indexed by Instr::op. keep in the same order as the Op enum.
+    static void *const handlers[NUM_OPS] = {
+        &&op_decode, &&op_cls, &&op_ret, &&op_jp, &&op_call, &&op_se_imm, &&op_sne_imm,
+        &&op_se_reg, &&op_ld_imm, &&op_add_imm, &&op_ld_reg, &&op_or, &&op_and, &&op_xor,
+        &&op_add_reg, &&op_sub, &&op_shr, &&op_subn, &&op_shl, &&op_sne_reg, &&op_ld_i,
+        &&op_jp_v0, &&op_rnd, &&op_drw, &&op_skp, &&op_sknp, &&op_ld_vx_dt, &&op_ld_vx_k,
+        &&op_ld_dt_vx, &&op_ld_st_vx, &&op_add_i, &&op_ld_f, &&op_ld_b, &&op_ld_mem_vx,
+        &&op_ld_vx_mem, &&op_invalid
+    };
+
+    if (cycles == 0) {
+        return 0;
+    }
+
+    Instr *ins;
+    uint64_t done = 0;
+
+    // the page pc is in, looked up again when pc leaves it. anything that
+    // can copy a page (writes, decode misses) sets code_base to NO_PAGE.
+    const uint16_t NO_PAGE = 0xFFFF;
+    Page *code = nullptr;
+    uint16_t code_base = NO_PAGE;
+
+    // (fetch phase) the decoded slot for pc, OP_DECODE fills it on a miss.
+#define FETCH() \
+    if ((pc & (MEM_SIZE - PAGE_SIZE)) != code_base) { \
+        code_base = pc & (MEM_SIZE - PAGE_SIZE); \
+        code = pages[code_base / PAGE_SIZE].get(); \
+    } \
+    ins = &code->decoded[pc % PAGE_SIZE]; \
+    PROFILE(record(pc, (readMem(pc) << 8) | readMem(pc + 1))); \
+    COVER(pc, fetchOpcode(pc)); \
+    pc += 2; \
+    goto *handlers[ins->op]
+
+#define NEXT() \
+    if (++done == cycles) return done; \
+    FETCH()
+
+    // after anything that ends an aot block (see translate.cpp), also stops
+    // at a pc stop has a block for.
+#define BLOCK_END() \
+    if (++done == cycles || (stop && pc < MEM_SIZE && stop->blocks[pc])) return done; \
+    FETCH()
+
+    FETCH();
 
-    timers();
+op_decode:
+    // a page shared with a fork gets copied before its slot is filled.
+    ins = &ownPage(((pc - 2) & (MEM_SIZE - 1)) / PAGE_SIZE).decoded[(pc - 2) % PAGE_SIZE];
+    code_base = NO_PAGE;
+    *ins = decode((readMem(pc - 2) << 8) | readMem(pc - 1));
+    goto *handlers[ins->op];
+op_cls:
+    std::memset(graphics, 0, sizeof(graphics));
+    display_dirty = true;
+    stores++;
+    NEXT();
+op_ret:
+    pc = pop();
+    BLOCK_END();
+op_jp: {
+    bool may_idle = polled || ins->nnn == pc - 2;
+    pc = ins->nnn;
+    if (may_idle) {
+        done += skipIdle(cycles - done - 1);
+    }
+    BLOCK_END();
+}
+op_call:
+    push(pc);
+    pc = ins->nnn;
+    BLOCK_END();
+op_se_imm:
+    if (v[ins->x] == ins->kk) pc += 2;
+    BLOCK_END();
+op_sne_imm:
+    if (v[ins->x] != ins->kk) pc += 2;
+    BLOCK_END();
+op_se_reg:
+    if (v[ins->x] == v[ins->y]) pc += 2;
+    BLOCK_END();
+op_ld_imm:
+    v[ins->x] = ins->kk;
+    NEXT();
+op_add_imm:
+    v[ins->x] += ins->kk;
+    NEXT();
+op_ld_reg:
+    v[ins->x] = v[ins->y];
+    NEXT();
+op_or:
+    v[ins->x] |= v[ins->y];
+    NEXT();
+op_and:
+    v[ins->x] &= v[ins->y];
+    NEXT();
+op_xor:
+    v[ins->x] ^= v[ins->y];
+    NEXT();
+op_add_reg:
+    // VF is written before Vx, same as interpret(), so x or y == 0xF behaves the same.
+    v[0xF] = (v[ins->x] + v[ins->y]) > UINT8_MAX;
+    v[ins->x] += v[ins->y];
+    NEXT();
+op_sub:
+    v[0xF] = v[ins->x] > v[ins->y];
+    v[ins->x] -= v[ins->y];
+    NEXT();
+op_shr:
+    v[0xF] = v[ins->x] & 0x1;
+    v[ins->x] >>= 1;
+    NEXT();
+op_subn:
+    v[0xF] = v[ins->x] < v[ins->y];
+    v[ins->x] = v[ins->y] - v[ins->x];
+    NEXT();
+op_shl:
+    v[0xF] = (v[ins->x] & 0x80) >> 7;
+    v[ins->x] <<= 1;
+    NEXT();
+op_sne_reg:
+    if (v[ins->x] != v[ins->y]) pc += 2;
+    BLOCK_END();
+op_ld_i:
+    index = ins->nnn;
+    NEXT();
+op_jp_v0:
+    pc = (ins->nnn + v[0]) & (MEM_SIZE - 1);
+    BLOCK_END();
+op_rnd:
+    v[ins->x] = (pcgNext(rng) >> 24) & ins->kk;
+    NEXT();
+op_drw:
+    drawSprite(v[ins->x], v[ins->y], ins->n);
+    NEXT();
+op_skp:
+    if (keys[v[ins->x] % NUM_KEYS]) pc += 2;
+    polled = true;
+    BLOCK_END();
+op_sknp:
+    if (!keys[v[ins->x] % NUM_KEYS]) pc += 2;
+    polled = true;
+    BLOCK_END();
+op_ld_vx_dt:
+    v[ins->x] = delay_timer;
+    polled = true;
+    NEXT();
+op_ld_vx_k: {
+    bool pressed = false;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        if (keys[i]) {
+            pressed = true;
+            v[ins->x] = i;
+            break;
+        }
+    }
+    if (!pressed) {
+        pc -= 2;
+        done += skipIdle(cycles - done - 1);
+    }
+    BLOCK_END();
+}
+op_ld_dt_vx:
+    delay_timer = v[ins->x];
+    NEXT();
+op_ld_st_vx:
+    sound_timer = v[ins->x];
+    soundChanged();
+    NEXT();
+op_add_i:
+    index += v[ins->x];
+    NEXT();
+op_ld_f:
+    index = FONT_ADDR + (v[ins->x] * 0x5);
+    NEXT();
+op_ld_b: {
+    uint8_t vx = v[ins->x];
+    uint8_t bcd[3] = {uint8_t(vx / 100), uint8_t((vx % 100) / 10), uint8_t(vx % 10)};
+    writeMem(index, bcd, 3);
+    code_base = NO_PAGE;
+    BLOCK_END();
+}
+op_ld_mem_vx:
+    writeMem(index, v, ins->x + 1);
+    code_base = NO_PAGE;
+    BLOCK_END();
+op_ld_vx_mem:
+    readMem(index, v, ins->x + 1);
+    NEXT();
+op_invalid:
+    invalid_count++;
+    if (!quiet) {
+        std::cerr << "Invalid Opcode: " << std::hex
+                  << ((readMem(pc - 2) << 8) | readMem(pc - 1)) << std::dec << std::endl;
+    }
+    BLOCK_END();
+
+#undef BLOCK_END
+#undef NEXT
+#undef FETCH
+}
+
+void Chip8::runJit(uint64_t cycles) {
+    if (!jit) {
+        jit = std::make_unique<::Jit>();
+    }
+    if (!jit->available()) {
+        runCached(cycles);
+        return;
+    }
+
+    ::Jit::Context ctx = {v, &index, pc, 0, &Chip8::jitStep, this, &polled, &delay_timer, keys, stack, &sp, fast_forward, &Chip8::jitLive};
+    while (cycles > 0) {
+        ::Jit::Block block = jit->lookup(pc, [this](uint16_t addr) { return readMem(addr); });
+        if (!block) {
+            // only Fx0A is never compiled. with nothing down it takes the
+            // rest of the run, the decode cache spins it (or fast-forwards
+            // it) in one go.
+            if (getKeys() == 0) {
+                runCached(cycles);
+                return;
+            }
+            runCached(1);
+            cycles--;
+            continue;
+        }
+        COVER(pc, fetchOpcode(pc));
+        ctx.pc = pc;
+        ctx.budget = cycles;
+        jit->run(block, &ctx);
+        pc = ctx.pc;
+        cycles = ctx.budget;
+        // a jump after a poll or to itself comes back here with fast-forward on.
+        if (fast_forward && cycles > 0) {
+            cycles -= skipIdle(cycles);
+        }
+    }
+}
+
+uint16_t Chip8::jitStep(void *ctx, uint16_t at, uint16_t opcode) {
+    Chip8 *chips = static_cast<Chip8*>(static_cast<::Jit::Context*>(ctx)->machine);
+#ifdef CHIPS_FUZZ
+    if (chips->coverage) {
+        chips->cover(at, opcode);
+    }
+#endif
+    chips->pc = at + 2;
+    chips->execute(opcode);
+    return chips->pc;
+}
+
+uint16_t Chip8::jitLive(void *ctx, uint16_t at) {
+    Chip8 *chips = static_cast<Chip8*>(static_cast<::Jit::Context*>(ctx)->machine);
+    chips->pc = at;
+    chips->interpret();
+    return chips->pc;
+}
+
+void Chip8::runAot(uint64_t cycles) {
+    if (!aot_bound) {
+        aot = AotRegistrar::find(*this);
+        aot_bound = true;
+    }
+
+    while (cycles > 0) {
+        if (!aot) {
+            runCached(cycles);
+            return;
+        }
+        if (pc < MEM_SIZE && aot->blocks[pc]) {
+            uint16_t start = pc;
+            unsigned from = aot->firsts[pc];
+            unsigned to = from + std::min<uint64_t>(aot->lengths[pc] - from, cycles);
+            COVER(pc, fetchOpcode(pc));
+            cycles -= to - from;
+            pc = aot->blocks[pc](*this, from, to);
+            // the loop ends inside the block, look at it at the next one.
+            if (polled || pc == start) {
+                cycles -= skipIdle(cycles);
+            }
+            // a 1nnn to itself would only spin out the rest of the budget,
+            // one call per cycle.
+            if (pc == start && cycles > 0 && fetchOpcode(pc) == (0x1000 | pc)) {
+                cycles = 0;
+            }
+            continue;
+        }
+        // no block here. the decode cache runs up to the next pc with one,
+        // or to the end of the budget.
+        cycles -= runCached(cycles, aot);
+    }
+}
+
+void Chip8::cycle() {
+    run(1);
+}
+
+void Chip8::run(uint64_t cycles) {
+    PROFILE(beginRun());
+    probe.left = 0; // the timers or keys may have changed since the last one
+    Backend b = backend;
+#ifdef CHIPS_PROFILE
+    if (profiler && (b == Backend::Jit || b == Backend::Aot)) {
+        b = Backend::Cached; // blocks have no per-instruction hook
+    }
+#endif
+    switch (b) {
+        case Backend::Interpreter:
+            for (uint64_t i = 0; i < cycles; i++) {
+                if (interpret()) {
+                    i += skipIdle(cycles - i - 1);
+                }
+            }
+            break;
+        case Backend::Cached:
+            runCached(cycles);
+            break;
+        case Backend::Jit:
+            runJit(cycles);
+            break;
+        case Backend::Aot:
+            runAot(cycles);
+            break;
+    }
+    PROFILE(endRun());
+}
+
+void Chip8::setBackend(Backend b) {
+    backend = b;
+}
+
+Chip8::Backend Chip8::getBackend() const {
+    return backend;
+}
+
+bool Chip8::parseBackend(const std::string& name, Backend& b) {
+    for (Backend candidate : {Backend::Interpreter, Backend::Cached, Backend::Jit, Backend::Aot}) {
+        if (name == backendName(candidate)) {
+            b = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* Chip8::backendName(Backend b) {
+    switch (b) {
+        case Backend::Interpreter: return "interp";
+        case Backend::Cached: return "cached";
+        case Backend::Jit: return "jit";
+        case Backend::Aot: return "aot";
+    }
+    return "?";
+}
+
+void Chip8::setProfiler(Profiler *p) {
+    profiler = p;
+}
+
+void Chip8::copyMemory(uint8_t *out) const {
+    for (size_t page = 0; page < NUM_PAGES; page++) {
+        std::memcpy(out + page * PAGE_SIZE, pages[page]->bytes, PAGE_SIZE);
+    }
 }
@@ -2,6 +2,13 @@
 #define CPU_CHIP_8
 
 #include <cstdint>
+#include <string>
+#include <memory>
+#include <bit>
+#include <type_traits>
+#include <span>
+
+#include "rng.hpp"
 
 #define SCREEN_WIDTH 64
 #define SCREEN_HEIGHT 32
@@ -10,22 +17,215 @@
 #define STACK_SIZE 16
 #define MEM_SIZE 4096 
 #define FONT_SIZE 80
+#define FONT_ADDR 0x50
 #define START_ADDR 0x200
+#define PAGE_SIZE 64                   // bytes per copy-on-write memory page
+#define NUM_PAGES (MEM_SIZE / PAGE_SIZE) // at most 64, see Chip8::owned_pages
+#define IDLE_MAX_PERIOD 256 // longest polling loop, in cycles, skipIdle() looks for
+
+#define STATE_MAGIC 0x53384843 // "CH8S" read as a little-endian uint32_t
+#define STATE_VERSION 2
+
+class Jit;
+class Profiler;
+struct RomImage;
+struct AotTable;
+class AotMachine;
+struct AudioQueue;
+
+// the display is packed one 64 pixel row per uint64_t, leftmost pixel in the msb.
+inline bool getPixel(const uint64_t *graphics, int x, int y) {
+    return (graphics[y] >> (SCREEN_WIDTH - 1 - x)) & 1;
+}
+
+// one sprite row placed at column x_pos, wrapped around the right edge.
+inline uint64_t spriteRow(uint8_t pixels, uint8_t x_pos) {
+    return std::rotr(uint64_t(pixels) << (SCREEN_WIDTH - 8), x_pos % SCREEN_WIDTH);
+}
+
+// fnv-1a over the packed display, for comparing screens between runs.
+inline uint64_t frameHash(const uint64_t *graphics) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int row = 0; row < SCREEN_HEIGHT; row++) {
+        for (int byte = 0; byte < 8; byte++) {
+            hash ^= (graphics[row] >> (56 - 8 * byte)) & 0xFF;
+            hash *= 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+// everything needed to resume a machine, in a fixed layout with no pointers,
+// so a snapshot is a plain memcpy and a state file can be read or mmap'd
+// straight into one. fields are in host byte order, magic doubles as the
+// byte order check. about 4.5 KB, cheap enough to keep one per child when
+// forking many runs off a parent.
+//
+// the backend and the caches aren't part of the state, they are rebuilt
+// from mem on demand after a restore.
+struct Chip8State {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t mem[MEM_SIZE];
+    uint64_t graphics[SCREEN_HEIGHT];
+    uint64_t seed;
+    uint64_t rng;  // pcg state for Cxkk
+    uint16_t stack[STACK_SIZE];
+    uint8_t v[NUM_REGS];
+    uint8_t keys[NUM_KEYS];
+    uint16_t index;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t reserved[9]; // zero, pads the size to a multiple of 8
+};
+
+static_assert(std::is_trivially_copyable_v<Chip8State>);
+static_assert(NUM_PAGES <= 64, "Chip8::owned_pages has a bit per page");
+static_assert(sizeof(Chip8State) == 8 + MEM_SIZE + 8 * SCREEN_HEIGHT + 16 + 2 * STACK_SIZE + NUM_REGS + NUM_KEYS + 16,
+              "Chip8State layout is part of the file format, bump STATE_VERSION when changing it");
 
 class Chip8 {
 private:
     uint8_t v[NUM_REGS]; // register from V0 to VF uint8_t mem[MEM_SIZE]; //memory uint16_t index; //index register uint16_t stack[STACK_SIZE]; //stack
-    uint8_t mem[MEM_SIZE]; // memory 
     uint16_t stack[STACK_SIZE];
-    bool graphics[SCREEN_WIDTH * SCREEN_HEIGHT]; // pixel data
+    uint64_t graphics[SCREEN_HEIGHT]; // pixel data, one row per word, msb is x = 0
     bool keys[NUM_KEYS]; //keymap
     uint16_t index; // index reg
     uint8_t sp; //stack pointer
     uint16_t pc; //program counter 
     uint8_t delay_timer;
     uint8_t sound_timer;
+    uint64_t seed;
+    uint64_t rng; // pcg state, see rng.hpp
+    uint64_t invalid_count;
+    uint64_t idle_cycles; // fast-forwarded by skipIdle()
+    uint32_t stores;      // memory writes and display changes, see IdleProbe
+    bool polled;          // Fx07, Ex9E or ExA1 ran since the last probe
+    bool fast_forward;
+    bool quiet;
+    bool display_dirty; // set by 00E0, Dxyn and restores, cleared by the frontend
+
+    // pre-decoded instructions, handled by runCached().
+    enum Op : uint8_t {
+        OP_DECODE, // slot is empty, decode it on the next fetch
+        OP_CLS, OP_RET, OP_JP, OP_CALL, OP_SE_IMM, OP_SNE_IMM, OP_SE_REG, OP_LD_IMM,
+        OP_ADD_IMM, OP_LD_REG, OP_OR, OP_AND, OP_XOR, OP_ADD_REG, OP_SUB, OP_SHR,
+        OP_SUBN, OP_SHL, OP_SNE_REG, OP_LD_I, OP_JP_V0, OP_RND, OP_DRW, OP_SKP,
+        OP_SKNP, OP_LD_VX_DT, OP_LD_VX_K, OP_LD_DT_VX, OP_LD_ST_VX, OP_ADD_I, OP_LD_F,
+        OP_LD_B, OP_LD_MEM_VX, OP_LD_VX_MEM, OP_INVALID,
+        NUM_OPS
+    };
+
+    struct Instr {
+        uint8_t op;
+        uint8_t x;
+        uint8_t y;
+        uint8_t n;
+        uint8_t kk;
+        uint16_t nnn;
+    };
+
+    // memory, in pages shared copy-on-write with forks. each page carries the
+    // decode cache for its bytes, one slot per address since nothing stops a
+    // rom from jumping to an odd address. writeMem() clears the slots a write
+    // covers. a page that is shared is never written, not even to fill a
+    // decode slot, so forks can run on different threads.
+    struct Page {
+        uint8_t bytes[PAGE_SIZE];
+        Instr decoded[PAGE_SIZE];
+    };
+    std::shared_ptr<Page> pages[NUM_PAGES];
+    // bit p set: pages[p] is known not to be shared, writes skip the check.
+    // only our own fork() can share a page again, it clears the mask.
+    mutable uint64_t owned_pages;
+
+    uint8_t readMem(uint16_t addr) const {
+        addr &= MEM_SIZE - 1;
+        return pages[addr / PAGE_SIZE]->bytes[addr % PAGE_SIZE];
+    }
+    uint16_t fetchOpcode(uint16_t addr) const {
+        addr &= MEM_SIZE - 1;
+        const uint8_t *bytes = pages[addr / PAGE_SIZE]->bytes;
+        if (addr % PAGE_SIZE != PAGE_SIZE - 1) {
+            return (bytes[addr % PAGE_SIZE] << 8) | bytes[addr % PAGE_SIZE + 1];
+        }
+        return (bytes[PAGE_SIZE - 1] << 8) | readMem(addr + 1); // straddles two pages
+    }
+    bool ownsPage(size_t page) const;
+    Page& ownPage(size_t page); // copies the page first if it is shared
+    void dropDecoded(uint16_t addr);
+
+public:
+    enum class Backend {
+        Interpreter, // fetch and decode with the nested switch on every cycle
+        Cached,      // pre-decoded instructions with threaded dispatch
+        Jit,         // x86-64 basic-block recompiler, Cached where it can't run
+        Aot          // blocks translated ahead of time by chips-aot, Cached for other roms
+    };
+    // "interp", "cached", "jit" or "aot", as the frontends take them on the command line.
+    static bool parseBackend(const std::string& name, Backend& backend); // false for anything else
+    static const char* backendName(Backend backend);
 
-    const uint8_t fonts[FONT_SIZE] = {
+private:
+    Backend backend;
+    std::unique_ptr<::Jit> jit; // created on first use of Backend::Jit
+    const AotTable *aot;        // translation of the loaded rom, see aot.hpp
+    bool aot_bound;             // aot was looked up for what's in memory now
+    Profiler *profiler;         // not owned, only fed in CHIPS_PROFILE builds
+    AudioQueue *audio;          // not owned, nullptr drops the sound edges
+    uint64_t ticks;             // timers() calls, the clock sound edges are stamped with
+    bool sound_on;              // sound_timer > 0 as of the last edge
+    uint8_t *coverage;          // not owned, only fed in CHIPS_FUZZ builds, see setCoverage()
+
+    static Instr decode(uint16_t opcode);
+    // len bytes from addr on, wrapping at MEM_SIZE. a page at a time, these
+    // are what Fx55/Fx65/Fx33/Dxyn go through.
+    void readMem(uint16_t addr, uint8_t *out, uint16_t len) const;
+    void writeMem(uint16_t addr, const uint8_t *data, uint16_t len);
+    void flushDecodeCache();
+    void invalidateRange(uint16_t addr, uint16_t len);
+    void replaceMem(const uint8_t *image); // copies in only the words that differ
+    void drawSprite(uint8_t x_pos, uint8_t y_pos, uint8_t height);
+    // the machine at a loop head, taken by skipIdle(). if the loop comes
+    // back to it with nothing stored and the same registers, every
+    // iteration until the timers or keys change is the same as that one.
+    struct IdleProbe {
+        uint64_t left; // run() budget left when taken, 0 if there is no probe
+        uint64_t rng;
+        uint64_t invalid_count;
+        uint32_t stores;
+        uint16_t pc;
+        uint16_t index;
+        uint16_t stack[STACK_SIZE];
+        uint8_t v[NUM_REGS];
+        uint8_t sp;
+        uint8_t delay_timer;
+        uint8_t sound_timer;
+
+        bool operator==(const IdleProbe &) const = default;
+    };
+    IdleProbe probe;
+
+    bool interpret(); // true after a jump or a key wait, where skipIdle() may apply
+    bool execute(uint16_t opcode); // interpret() past the fetch, pc already after it
+    IdleProbe takeProbe(uint64_t left) const;
+    uint64_t skipIdle(uint64_t left);
+    uint64_t runCached(uint64_t cycles, const AotTable *stop = nullptr); // the cycles it took, less if it stopped
+    void runJit(uint64_t cycles);
+    static uint16_t jitStep(void *ctx, uint16_t at, uint16_t opcode); // Jit::Context::step
+    static uint16_t jitLive(void *ctx, uint16_t at);                  // Jit::Context::live, interpret() at pc = at
+    void runAot(uint64_t cycles);
+    void soundChanged(); // after sound_timer is set, queues an edge if it turned on or off
+    void cover(uint16_t addr, uint16_t opcode);
+
+    Chip8(const Chip8& parent); // fork() only
+    friend class AotMachine;
+
+public:
+    // font sprites, loaded at FONT_ADDR. shared with the other engines.
+    static constexpr uint8_t fonts[FONT_SIZE] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
         0x20, 0x60, 0x20, 0x20, 0x70, // 1
         0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -43,15 +243,77 @@ private:
         0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
     };
-public:
+
     Chip8();
-    bool loadRom(const std::string& rom_file); // to load the ROM in the memory.
+    ~Chip8();
+    Chip8& operator=(const Chip8&) = delete;
+    bool loadRom(const std::string& rom_file); // maps the file, see romcache.hpp
+    bool loadRom(std::span<const uint8_t> rom); // from a rom already in memory, which isn't kept
+    // back to power-on with this rom loaded, one copy of memory. keeps the
+    // seed, backend, profiler and quiet flag, and the cached code for
+    // whatever memory didn't change, so a reset to the same rom is cheap.
+    void reset(const RomImage& rom);
+    // a child machine in the same state, sharing this one's memory and decoded
+    // code copy-on-write: fork() copies the registers and display, a page is
+    // only duplicated when either side writes to it (Fx55/Fx33) or decodes
+    // into a slot of it. the child gets the seed and backend but no profiler,
+    // and compiles its own jit blocks. parent and children can run on
+    // different threads.
+    std::unique_ptr<Chip8> fork() const;
+    size_t footprint() const; // bytes held by this machine alone, shared pages not counted
     void push(const uint16_t data);
     uint16_t pop();
     void cycle(); // to fetch, decode and execute
-    void timers();
+    void run(uint64_t cycles); // cycle() in a loop, without the per call overhead
+    void setBackend(Backend b);
+    Backend getBackend() const;
+    void setProfiler(Profiler *p); // nullptr detaches, see profiler.hpp
+    // the buzzer goes out as on/off edges through q, see audio.hpp. the
+    // default (nullptr) is the headless sink, edges are just dropped. set it
+    // from the thread that runs the machine.
+    void setAudio(AudioQueue *q);
+    // guest coverage for fuzzers: map holds MEM_SIZE + Profiler::NUM_CLASSES
+    // saturating hit counters, one per pc and then one per opcode class.
+    // only fed in CHIPS_FUZZ builds. the jit and aot backends count the
+    // first instruction of each block they run. nullptr detaches.
+    void setCoverage(uint8_t *map);
+    void timers(); // one 60 Hz tick of the delay and sound timers, see Scheduler
     bool* keyPad();
-    bool* getGraphics();
+    void setKeys(uint16_t mask); // bit k is key k
+    uint16_t getKeys() const;
+    void setSeed(uint64_t seed); // restarts the Cxkk sequence, DEFAULT_SEED until set
+    uint64_t getSeed() const;
+    void setQuiet(bool quiet); // no diagnostics on stdout/stderr, for batch jobs
+    uint64_t getInvalidCount() const; // invalid opcodes executed since construction
+    // idle loops (Fx0A with no key down, a jump to itself, a loop polling the
+    // delay timer or keys that stores nothing) are fast-forwarded to the end
+    // of the run() call, i.e. the next timer tick or key change, with exactly
+    // the state running them would have left. on by default, off while
+    // profiling.
+    void setFastForward(bool on);
+    uint64_t getIdleCycles() const; // cycles skipped that way, they still count as run
+    const uint64_t* getGraphics() const;
+    bool displayDirty() const; // the display may have changed since clearDisplayDirty()
+    void clearDisplayDirty();
+
+    // snapshots. loadState() only drops the cached code for the memory that
+    // actually differs, so restoring over a close relative is cheap.
+    // the scheduler's frame position isn't part of the state, save on a frame
+    // boundary (after Scheduler::runFrame()) to resume a run exactly.
+    void saveState(Chip8State& state) const;
+    bool loadState(const Chip8State& state);
+    bool saveState(const std::string& state_file) const;
+    bool loadState(const std::string& state_file);
+
+    // read-only view of the machine state, for headless runs and debugging.
+    const uint8_t* getRegisters() const;
+    const uint16_t* getStack() const;
+    void copyMemory(uint8_t *out) const; // all MEM_SIZE bytes
+    uint16_t getIndex() const;
+    uint16_t getPC() const;
+    uint8_t getSP() const;
+    uint8_t getDelayTimer() const;
+    uint8_t getSoundTimer() const;
 };
 
 #endif
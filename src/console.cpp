@@ -1,9 +1,12 @@
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include "console.hpp"
 
-Console::Console(const std::string &win_title, const int win_width, const int win_height) {
+Console::Console(const std::string &win_title, const int win_width, const int win_height) : audio_device(0), wave(audio) {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
         std::cerr << "SDL Init failed" << std::endl;
         std::exit(EXIT_FAILURE);
@@ -20,110 +23,193 @@ Console::Console(const std::string &win_title, const int win_width, const int wi
         SDL_Quit();
         std::exit(EXIT_FAILURE);
     }
+    screen = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (!screen) {
+        std::cerr << "texture creation failed." << std::endl;
+        SDL_Quit();
+        std::exit(EXIT_FAILURE);
+    }
+
+    // float mono at our rate, SDL converts if the device wants something else.
+    SDL_AudioSpec want = {};
+    want.freq = AUDIO_RATE;
+    want.format = AUDIO_F32SYS;
+    want.channels = 1;
+    want.samples = AUDIO_BUFFER;
+    want.callback = audioCallback;
+    want.userdata = this;
+    SDL_AudioSpec have;
+    audio_device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if (audio_device == 0) {
+        std::cerr << "audio device failed, no sound: " << SDL_GetError() << std::endl;
+    }
 }
 
-void Console::updateWindow(const bool* graphics_buf) {
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
-
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    
-    for (int idx = 0; idx < 2048; idx++) {
-        if (graphics_buf[idx]) {
-            auto x = (idx % SCREEN_WIDTH) * SCALE;
-            auto y = (idx / SCREEN_WIDTH) * SCALE;
-            
-            SDL_Rect rect = {x, y, 10, 10};
-            SDL_RenderFillRect(renderer, &rect);
-        }
+void Console::audioCallback(void *userdata, Uint8 *stream, int len) {
+    Console *console = static_cast<Console*>(userdata);
+    console->wave.render(reinterpret_cast<float*>(stream), len / int(sizeof(float)));
+}
+
+void Console::updateWindow(const uint64_t* graphics_buf) {
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(screen, nullptr, &pixels, &pitch) == 0) {
+        expandDisplay(graphics_buf, static_cast<uint32_t*>(pixels), pitch);
+        SDL_UnlockTexture(screen);
     }
+    present();
+}
+
+void Console::present() {
+    // one textured quad for the whole screen, whatever is lit.
+    SDL_RenderCopy(renderer, screen, nullptr, nullptr);
     SDL_RenderPresent(renderer);
 }
 
-void Console::run(Chip8 *chips) {
-    bool *keys = chips->keyPad(); SDL_Event event; 
-    bool running = true;
-    while (running) {
-        bool hold = false;
-        while (SDL_PollEvent(&event)) {
+// the chip-8 key for a host key, -1 if it isn't one.
+static int chipKey(SDL_Keycode sym) {
+    switch (sym) {
+        case SDLK_1: return 0x1;
+        case SDLK_2: return 0x2;
+        case SDLK_3: return 0x3;
+        case SDLK_4: return 0xC;
+
+        case SDLK_q: return 0x4;
+        case SDLK_w: return 0x5;
+        case SDLK_e: return 0x6;
+        case SDLK_r: return 0xD;
+
+        case SDLK_a: return 0x7;
+        case SDLK_s: return 0x8;
+        case SDLK_d: return 0x9;
+        case SDLK_f: return 0xE;
+
+        case SDLK_z: return 0xA;
+        case SDLK_x: return 0x0;
+        case SDLK_c: return 0xB;
+        case SDLK_v: return 0xF;
+
+        default: return -1;
+    }
+}
+
+void Console::run(Chip8 *chips, Scheduler *scheduler, Rewind *rewind, InputTrace *recording, FrameStream *stream) {
+    std::atomic<bool> running = true;
+    std::atomic<bool> rewinding = false;
+    std::atomic<uint16_t> key_mask = 0;
+    TripleBuffer<Frame> frames;
+
+    if (recording) {
+        rewind = nullptr;
+    }
+    if (rewind || recording || stream) {
+        // keys only change between update() calls, so what's down now is
+        // what the whole frame ran with.
+        scheduler->setFrameCallback([=] {
+            if (rewind) {
+                rewind->capture(*chips);
+            }
+            if (recording) {
+                recording->addFrame(chips->getKeys());
+                uint64_t frame = scheduler->getFrameCount();
+                if (frame % TRACE_CHECKPOINT_FRAMES == 0) {
+                    recording->addCheckpoint(frame, frameHash(chips->getGraphics()));
+                }
+            }
+            if (stream) {
+                stream->publish(*chips, scheduler->getFrameCount(), scheduler->getCycleCount());
+            }
+        });
+    }
+
+    if (audio_device) {
+        chips->setAudio(&audio); // before the thread starts, it's the one feeding the queue
+        SDL_PauseAudioDevice(audio_device, 0);
+    }
+
+    std::thread emulation([&] {
+        auto publish = [&] {
+            std::copy(chips->getGraphics(), chips->getGraphics() + SCREEN_HEIGHT, frames.back().graphics);
+            frames.publish();
+            chips->clearDisplayDirty();
+        };
+
+        while (running.load(std::memory_order_relaxed)) {
+            // whatever is held right now, also while rewinding.
+            chips->setKeys(key_mask.load(std::memory_order_relaxed));
+
+            if (rewind && rewinding.load(std::memory_order_relaxed)) {
+                // step back a frame per host frame.
+                if (rewind->frames() > 1 && rewind->restore(*chips, 1)) {
+                    publish();
+                }
+                scheduler->resync();
+                scheduler->waitNextFrame();
+                continue;
+            }
+
+            // the scheduler decides how many frames are due, the cpu speed
+            // doesn't depend on the display refresh rate. frames that didn't
+            // clear or draw anything aren't handed over at all.
+            if (scheduler->update() > 0 && chips->displayDirty()) {
+                publish();
+            }
+            scheduler->waitNextFrame();
+        }
+    });
+
+    SDL_Event event;
+    uint16_t held = 0;
+    while (running.load(std::memory_order_relaxed)) {
+        // sleeps until an event comes in or EVENT_WAIT_MS is up.
+        bool got = SDL_WaitEventTimeout(&event, EVENT_WAIT_MS);
+        for (; got; got = SDL_PollEvent(&event)) {
             switch (event.type) {
                 case SDL_QUIT:
                     running = false;
                     break;
-                case SDL_KEYDOWN:
-                    switch (event.key.keysym.sym) {
-                        case SDLK_ESCAPE: exit(EXIT_SUCCESS);
-
-                        case SDLK_1: keys[0x1] = true; break;
-                        case SDLK_2: keys[0x2] = true; break;
-                        case SDLK_3: keys[0x3] = true; break;
-                        case SDLK_4: keys[0xC] = true; break;
-
-                        case SDLK_q: keys[0x4] = true; break;
-                        case SDLK_w: keys[0x5] = true; break;
-                        case SDLK_e: keys[0x6] = true; break;
-                        case SDLK_r: keys[0xD] = true; break;
-
-                        case SDLK_a: keys[0x7] = true; break;
-                        case SDLK_s: keys[0x8] = true; break;
-                        case SDLK_d: keys[0x9] = true; break;
-                        case SDLK_f: keys[0xE] = true; break;
-
-                        case SDLK_z: keys[0xA] = true; break;
-                        case SDLK_x: keys[0x0] = true; break;
-                        case SDLK_c: keys[0xB] = true; break;
-                        case SDLK_v: keys[0xF] = true; break;
-
-                        default: break;
+                case SDL_WINDOWEVENT:
+                    // the texture still holds the last frame, show it again.
+                    if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                        present();
                     }
-                    hold = true;
-                    if (hold) chips->cycle();
                     break;
-                case SDL_KEYUP:
-                    switch (event.key.keysym.sym) {
-                        case SDLK_1: keys[0x1] = false; break;
-                        case SDLK_2: keys[0x2] = false; break;
-                        case SDLK_3: keys[0x3] = false; break;
-                        case SDLK_4: keys[0xC] = false; break;
-
-                        case SDLK_q: keys[0x4] = false; break;
-                        case SDLK_w: keys[0x5] = false; break;
-                        case SDLK_e: keys[0x6] = false; break;
-                        case SDLK_r: keys[0xD] = false; break;
-
-                        case SDLK_a: keys[0x7] = false; break;
-                        case SDLK_s: keys[0x8] = false; break;
-                        case SDLK_d: keys[0x9] = false; break;
-                        case SDLK_f: keys[0xE] = false; break;
-
-                        case SDLK_z: keys[0xA] = false; break;
-                        case SDLK_x: keys[0x0] = false; break;
-                        case SDLK_c: keys[0xB] = false; break;
-                        case SDLK_v: keys[0xF] = false; break;
-                        default: break;
+                case SDL_KEYDOWN:
+                case SDL_KEYUP: {
+                    bool down = event.type == SDL_KEYDOWN;
+                    SDL_Keycode sym = event.key.keysym.sym;
+                    if (sym == SDLK_ESCAPE) {
+                        running = false;
+                    } else if (sym == REWIND_KEY) {
+                        rewinding = down;
+                    } else if (int key = chipKey(sym); key >= 0) {
+                        held = down ? held | (1u << key) : held & ~(1u << key);
                     }
-                    hold = false;
                     break;
+                }
                 default:
                     break;
             }
-        } 
-        if (hold) {
-            continue;
         }
+        key_mask.store(held, std::memory_order_relaxed);
 
-        for (int i = 0; i <= IPS; i++) {
-            chips->cycle();
+        if (frames.read()) {
+            updateWindow(frames.front().graphics);
         }
-        updateWindow(chips->getGraphics());
     }
-}
 
-void Console::beep() {
-    // TODO: implement audio 
+    emulation.join();
+    if (audio_device) {
+        SDL_PauseAudioDevice(audio_device, 1);
+        chips->setAudio(nullptr);
+    }
 }
 
 Console::~Console() {
+    if (audio_device) {
+        SDL_CloseAudioDevice(audio_device);
+    }
+    SDL_DestroyTexture(screen);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(win);
     SDL_Quit();
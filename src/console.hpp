@@ -5,21 +5,55 @@
 #include <string>
 
 #include "chip8.hpp" 
+#include "scheduler.hpp"
+#include "rewind.hpp"
+#include "display.hpp"
+#include "trace.hpp"
+#include "triple.hpp"
+#include "audio.hpp"
+#include "observe.hpp"
 
-#define IPS 5  // INS -> Instruction Per Second
 #define SCALE 10
+#define REWIND_KEY SDLK_BACKSPACE // hold to run backwards, one frame per frame
+#define EVENT_WAIT_MS 1           // render thread sleep between checks when nothing happens
 
 class Console {
 private:
     SDL_Window *win;
     SDL_Renderer *renderer;
+    SDL_Texture *screen; // 64x32 streaming texture, scaled up by the gpu
+    SDL_AudioDeviceID audio_device; // 0 if audio couldn't be opened, the game runs silent
+
+    // the machine's sound edges, played by the device callback on SDL's audio thread.
+    AudioQueue audio;
+    SquareWave wave;
+
+    // a finished display, handed from the emulation thread to the render thread.
+    struct Frame {
+        uint64_t graphics[SCREEN_HEIGHT];
+    };
+
+    void present();
+    static void audioCallback(void *userdata, Uint8 *stream, int len);
 public:
     Console(const std::string &win_title, int win_width, int win_height);
     ~Console();
 
-    void updateWindow(const bool *graphics_buf);
-    void beep();
-    void run(Chip8 *chips);
+    void updateWindow(const uint64_t *graphics_buf); // uploads the display and presents it
+    // emulation runs on its own thread, the calling thread polls input and
+    // renders. keys go over as an atomic 16-bit mask, displays come back
+    // through a triple buffer, so a slow vsync'd present never holds up the
+    // emulation and vice versa. chips and scheduler belong to the emulation
+    // thread until run() returns.
+    //
+    // the buzzer plays while run() is in here, if the audio device opened.
+    //
+    // rewind keeps history for the rewind key, recording gets every frame's
+    // keys and a display hash every TRACE_CHECKPOINT_FRAMES. rewinding is
+    // off while recording, the trace can't go back in time. stream gets
+    // every frame that runs forward, rewound ones aren't published.
+    void run(Chip8 *chips, Scheduler *scheduler, Rewind *rewind = nullptr, InputTrace *recording = nullptr,
+             FrameStream *stream = nullptr);
 };
 
 #endif
@@ -0,0 +1,87 @@
+#include <cstring>
+
+#include "delta.hpp"
+
+#define DELTA_HEADER 4                     // skip + count
+#define DELTA_MIN_GAP DELTA_HEADER         // shorter gaps are cheaper to keep in the run
+#define DELTA_MAX_FIELD 0xFFFF
+
+namespace {
+
+inline uint64_t load64(const uint8_t *p) {
+    uint64_t w;
+    std::memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+inline uint8_t* putHeader(uint8_t *out, size_t skip, size_t count) {
+    uint16_t fields[2] = {uint16_t(skip), uint16_t(count)};
+    std::memcpy(out, fields, sizeof(fields));
+    return out + sizeof(fields);
+}
+
+}
+
+size_t deltaEncode(const uint8_t *a, const uint8_t *b, size_t len, uint8_t *out) {
+    uint8_t *o = out;
+    size_t pos = 0;
+    size_t last = 0; // end of the previous run
+
+    while (pos < len) {
+        // skip the unchanged bytes, a word at a time while we can.
+        while (pos + 8 <= len && load64(a + pos) == load64(b + pos)) {
+            pos += 8;
+        }
+        while (pos < len && a[pos] == b[pos]) {
+            pos++;
+        }
+        if (pos == len) {
+            break;
+        }
+
+        // the run goes on until DELTA_MIN_GAP unchanged bytes in a row.
+        size_t start = pos;
+        size_t same = 0;
+        for (; pos < len && same < DELTA_MIN_GAP; pos++) {
+            same = a[pos] == b[pos] ? same + 1 : 0;
+        }
+        size_t end = pos - same;
+
+        size_t skip = start - last;
+        while (skip > DELTA_MAX_FIELD) {
+            o = putHeader(o, DELTA_MAX_FIELD, 0);
+            skip -= DELTA_MAX_FIELD;
+        }
+        for (size_t i = start; i < end;) {
+            size_t count = end - i < DELTA_MAX_FIELD ? end - i : DELTA_MAX_FIELD;
+            o = putHeader(o, skip, count);
+            for (size_t j = 0; j < count; j++, i++) {
+                *o++ = a[i] ^ b[i];
+            }
+            skip = 0;
+        }
+        last = end;
+        pos = end;
+    }
+    return o - out;
+}
+
+bool deltaApply(uint8_t *buf, size_t len, const uint8_t *delta, size_t delta_len) {
+    size_t pos = 0;
+    size_t i = 0;
+    while (i + DELTA_HEADER <= delta_len) {
+        uint16_t fields[2];
+        std::memcpy(fields, delta + i, sizeof(fields));
+        i += DELTA_HEADER;
+
+        size_t count = fields[1];
+        pos += fields[0];
+        if (pos + count > len || i + count > delta_len) {
+            return false;
+        }
+        for (size_t j = 0; j < count; j++) {
+            buf[pos++] ^= delta[i++];
+        }
+    }
+    return i == delta_len;
+}
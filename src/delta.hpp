@@ -0,0 +1,25 @@
+#ifndef CHIPS_DELTA
+#define CHIPS_DELTA
+
+#include <cstdint>
+#include <cstddef>
+
+// xor deltas between two equal sized buffers, with the runs of unchanged
+// bytes left out. the output is a list of
+//     [uint16_t skip][uint16_t count][count bytes of a ^ b]
+// where skip counts the unchanged bytes since the previous run. headers are
+// in host byte order. since it's a plain xor, applying a delta of (a, b) to
+// a gives b and applying it to b gives a.
+//
+// gaps shorter than a header are folded into the run, so frames that flip a
+// few scattered bytes come out at a few bytes per change.
+
+// worst case output size for len bytes of input.
+inline size_t deltaMaxSize(size_t len) {
+    return 2 * len + 16;
+}
+
+size_t deltaEncode(const uint8_t *a, const uint8_t *b, size_t len, uint8_t *out);
+bool deltaApply(uint8_t *buf, size_t len, const uint8_t *delta, size_t delta_len); // false if it runs past buf
+
+#endif
@@ -0,0 +1,36 @@
+#include "display.hpp"
+
+namespace {
+
+// all-ones or all-zero word for each pixel of every possible display byte,
+// so a byte expands with plain loads, ands and xors that the compiler turns
+// into vector ops even at -O2. 8 KB, built at compile time.
+struct PixelMasks {
+    uint32_t mask[256][8];
+
+    constexpr PixelMasks() : mask() {
+        for (int bits = 0; bits < 256; bits++) {
+            for (int k = 0; k < 8; k++) {
+                mask[bits][k] = (bits & (0x80 >> k)) ? ~0u : 0u;
+            }
+        }
+    }
+};
+
+constexpr PixelMasks PIXEL_MASKS;
+
+}
+
+void expandDisplay(const uint64_t *graphics, uint32_t *pixels, size_t pitch, uint32_t on, uint32_t off) {
+    const uint32_t flip = on ^ off;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        uint32_t *line = reinterpret_cast<uint32_t*>(reinterpret_cast<uint8_t*>(pixels) + y * pitch);
+        const uint64_t row = graphics[y];
+        for (int byte = 0; byte < SCREEN_WIDTH / 8; byte++) {
+            const uint32_t *mask = PIXEL_MASKS.mask[(row >> (SCREEN_WIDTH - 8 - 8 * byte)) & 0xFF];
+            for (int k = 0; k < 8; k++) {
+                line[8 * byte + k] = off ^ (flip & mask[k]);
+            }
+        }
+    }
+}
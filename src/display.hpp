@@ -0,0 +1,19 @@
+#ifndef CHIPS_DISPLAY
+#define CHIPS_DISPLAY
+
+#include <cstdint>
+#include <cstddef>
+
+#include "chip8.hpp"
+
+#define PIXEL_ON 0xFFFFFFFFu  // argb8888 white
+#define PIXEL_OFF 0xFF000000u // argb8888 black
+
+// expands the packed display into 32-bit pixels, one per chip-8 pixel.
+// pitch is in bytes like SDL's, so it can write straight into a locked
+// texture. branch-free, each display byte becomes 8 pixels through a mask
+// table in a loop that gets vectorized.
+void expandDisplay(const uint64_t *graphics, uint32_t *pixels, size_t pitch,
+                   uint32_t on = PIXEL_ON, uint32_t off = PIXEL_OFF);
+
+#endif
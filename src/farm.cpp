@@ -0,0 +1,277 @@
+// chips-farm: runs a manifest of jobs on a thread pool, one Chip8 per job,
+// and streams one JSON line of results per finished job.
+//
+// manifest, one job per line, '#' starts a comment:
+//     path/to/rom  path/to/trace|-  seed  cycles
+// traces are binary input traces (trace.hpp), one key mask per frame of
+// 1/60 s of emulated time at --ips. the manifest's seed is used, not the
+// trace's, so one recording can drive many seeds.
+//
+// roms come from the shared RomCache, mapped and validated once, and each
+// job starts with a reset of the worker's machine from the cached image. traces are read
+// once too, all of it shared read-only between the jobs.
+// workers start on their own slice of the jobs and steal from the others
+// once they run dry, so a few slow jobs don't hold up a whole slice.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+
+#include "chip8.hpp"
+#include "scheduler.hpp"
+#include "trace.hpp"
+#include "romcache.hpp"
+
+namespace {
+
+struct Job {
+    std::string rom_file;
+    std::string trace_file;
+    uint64_t seed;
+    uint64_t cycles;
+    std::shared_ptr<const RomImage> rom;    // from RomCache::shared()
+    const InputTrace *trace;                // nullptr if none
+};
+
+// one per worker. the owner takes from the back, thieves from the front.
+class WorkQueue {
+private:
+    std::mutex lock;
+    std::deque<size_t> jobs;
+public:
+    void push(size_t job) {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.push_back(job);
+    }
+
+    bool pop(size_t &job) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (jobs.empty()) {
+            return false;
+        }
+        job = jobs.back();
+        jobs.pop_back();
+        return true;
+    }
+
+    bool steal(size_t &job) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (jobs.empty()) {
+            return false;
+        }
+        job = jobs.front();
+        jobs.pop_front();
+        return true;
+    }
+};
+
+void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [--threads N] [--ips N] [--backend interp|cached|jit|aot]\n"
+              << "       [--out results.jsonl] manifest" << std::endl;
+}
+
+std::string jsonString(const std::string &s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (uint8_t(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// chips is the worker's machine, reused from job to job. reset() only
+// recopies memory that differs, so the decode cache and jit blocks carry
+// over between jobs on the same rom. executed gets the cycles that weren't
+// fast-forwarded.
+std::string runJob(Chip8 &chips, size_t id, const Job &job, uint32_t ips, uint64_t &executed) {
+    auto start = std::chrono::steady_clock::now();
+
+    chips.setSeed(job.seed);
+    chips.reset(*job.rom);
+
+    Scheduler scheduler(&chips, ips);
+    scheduler.setMode(Scheduler::Mode::Uncapped);
+    // keys change on frame boundaries only, like a player polled once per frame.
+    if (job.trace) {
+        TraceCursor cursor(job.trace);
+        chips.setKeys(cursor.next());
+        scheduler.setFrameCallback([&] { chips.setKeys(cursor.next()); });
+        scheduler.runCycles(job.cycles);
+    } else {
+        scheduler.runCycles(job.cycles);
+    }
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    executed = scheduler.getCycleCount() - chips.getIdleCycles();
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)frameHash(chips.getGraphics()));
+
+    std::ostringstream out;
+    out << "{\"job\":" << id
+        << ",\"rom\":" << jsonString(job.rom_file)
+        << ",\"trace\":" << jsonString(job.trace_file)
+        << ",\"seed\":" << job.seed
+        << ",\"cycles\":" << scheduler.getCycleCount()
+        << ",\"frames\":" << scheduler.getFrameCount()
+        << ",\"invalid\":" << chips.getInvalidCount()
+        << ",\"idle\":" << chips.getIdleCycles()
+        << ",\"hash\":\"" << hash << "\""
+        << ",\"wall_s\":" << std::fixed << std::setprecision(6) << secs << "}";
+    return out.str();
+}
+
+}
+
+int main(int argc, char** argv) {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t ips = DEFAULT_IPS;
+    Chip8::Backend backend = Chip8::Backend::Cached;
+    const char *manifest_file = nullptr;
+    const char *out_file = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--ips" && i + 1 < argc) {
+            ips = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--backend" && i + 1 < argc) {
+            if (!Chip8::parseBackend(argv[++i], backend)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--out" && i + 1 < argc) {
+            out_file = argv[++i];
+        } else if (!manifest_file && arg[0] != '-') {
+            manifest_file = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!manifest_file || ips == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream manifest(manifest_file);
+    if (!manifest) {
+        std::cerr << "failed to read manifest." << std::endl;
+        return 1;
+    }
+
+    // every rom and trace is loaded once, jobs only point at them.
+    std::map<std::string, InputTrace> traces;
+    std::vector<Job> jobs;
+    std::string line;
+    for (int line_no = 1; std::getline(manifest, line); line_no++) {
+        std::istringstream fields(line.substr(0, line.find('#')));
+        Job job;
+        if (!(fields >> job.rom_file)) {
+            continue;
+        }
+        if (!(fields >> job.trace_file >> job.seed >> job.cycles)) {
+            std::cerr << manifest_file << ":" << line_no << ": expected rom trace seed cycles" << std::endl;
+            return 1;
+        }
+
+        job.rom = RomCache::shared().load(job.rom_file);
+        if (!job.rom) {
+            std::cerr << "in " << job.rom_file << std::endl;
+            return 1;
+        }
+
+        job.trace = nullptr;
+        if (job.trace_file != "-") {
+            if (!traces.count(job.trace_file) && !traces[job.trace_file].load(job.trace_file)) {
+                std::cerr << "in " << job.trace_file << std::endl;
+                return 1;
+            }
+            job.trace = &traces[job.trace_file];
+        }
+        jobs.push_back(job);
+    }
+
+    std::ofstream out_stream;
+    if (out_file) {
+        out_stream.open(out_file, std::ios::out | std::ios::trunc);
+        if (!out_stream) {
+            std::cerr << "failed to open " << out_file << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &out = out_file ? out_stream : std::cout;
+    std::mutex out_lock;
+
+    // contiguous slices, so the owner works through its jobs in manifest order.
+    threads = std::min<size_t>(threads, std::max<size_t>(jobs.size(), 1));
+    std::vector<WorkQueue> queues(threads);
+    for (size_t w = 0; w < threads; w++) {
+        size_t begin = jobs.size() * w / threads;
+        size_t end = jobs.size() * (w + 1) / threads;
+        for (size_t j = end; j > begin; j--) {
+            queues[w].push(j - 1);
+        }
+    }
+
+    std::atomic<uint64_t> total_cycles = 0; // executed, see runJob()
+    auto worker = [&](size_t w) {
+        // one machine per worker, reset in place for every job it takes.
+        std::unique_ptr<Chip8> chips = std::make_unique<Chip8>();
+        chips->setQuiet(true);
+        chips->setBackend(backend);
+
+        size_t job;
+        for (;;) {
+            bool found = queues[w].pop(job);
+            for (size_t k = 1; !found && k < threads; k++) {
+                found = queues[(w + k) % threads].steal(job);
+            }
+            if (!found) {
+                return; // nothing adds jobs once the pool runs, so empty means done
+            }
+
+            uint64_t executed;
+            std::string result = runJob(*chips, job, jobs[job], ips, executed);
+            total_cycles += executed;
+            std::lock_guard<std::mutex> guard(out_lock);
+            out << result << '\n' << std::flush;
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (size_t w = 0; w < threads; w++) {
+        pool.emplace_back(worker, w);
+    }
+    for (auto &t : pool) {
+        t.join();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << "jobs: " << jobs.size() << " threads: " << threads
+              << " time: " << std::fixed << std::setprecision(3) << secs << "s"
+              << " cycles/s: " << std::setprecision(0) << (secs > 0 ? total_cycles / secs : 0.0) << std::endl;
+    return 0;
+}
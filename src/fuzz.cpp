@@ -0,0 +1,135 @@
+// chips-fuzz: coverage-guided fuzz target for the core, for libFuzzer or AFL.
+//
+// an input is a rom plus the keys to play it with:
+//     byte 0     flags: bits 0-1 backend (interp, cached, jit, aot), bit 2
+//                fast-forward off, bit 3 check the end state against the
+//                interpreter
+//     bytes 1-2  rom length, little-endian, cut to ROM_MAX_SIZE and to what's there
+//     ...        the rom
+//     ...        the rest, a little-endian key mask per frame
+// every input runs FUZZ_FRAMES frames of FUZZ_FRAME_CYCLES cycles and a
+// timer tick, no keys down once the trace runs out. the machines are made
+// once and reset in place from the input's image, one copy of memory.
+//
+// besides the host coverage the compiler adds, the guest's (pcs hit, opcode
+// classes run) goes to libFuzzer as extra counters, so inputs that reach new
+// rom code are kept even when they run the same host code. built without
+// libFuzzer (gcc, AFL's @@ mode, replaying a crash), main() runs each file
+// named on the command line once and prints its guest coverage.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <iterator>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include "chip8.hpp"
+#include "profiler.hpp"
+#include "romcache.hpp"
+
+#define FUZZ_FRAMES 64
+#define FUZZ_FRAME_CYCLES 64 // so at most 4096 cycles an input
+#define FUZZ_COVERAGE_SIZE (MEM_SIZE + Profiler::NUM_CLASSES)
+
+namespace {
+
+// libFuzzer picks up this section as extra coverage, elsewhere it's a plain array.
+__attribute__((section("__libfuzzer_extra_counters")))
+uint8_t guest_coverage[FUZZ_COVERAGE_SIZE];
+
+struct Machines {
+    Chip8 test;
+    Chip8 reference; // interpreter, every instruction executed
+    RomImage image;
+
+    Machines() {
+        test.setQuiet(true);
+        test.setCoverage(guest_coverage);
+        reference.setQuiet(true);
+        reference.setBackend(Chip8::Backend::Interpreter);
+        reference.setFastForward(false);
+    }
+};
+
+Machines& machines() {
+    static Machines *m = new Machines(); // never freed, outlives every input
+    return *m;
+}
+
+void play(Chip8 &chips, const uint8_t *keys, size_t frames) {
+    for (size_t frame = 0; frame < FUZZ_FRAMES; frame++) {
+        uint16_t mask = frame < frames ? keys[2 * frame] | keys[2 * frame + 1] << 8 : 0;
+        chips.setKeys(mask);
+        chips.run(FUZZ_FRAME_CYCLES);
+        chips.timers();
+    }
+}
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size < 3) {
+        return 0;
+    }
+    uint8_t flags = data[0];
+    size_t rom_size = std::min<size_t>({size_t(data[1] | data[2] << 8), size - 3, ROM_MAX_SIZE});
+    const uint8_t *rom = data + 3;
+    const uint8_t *keys = rom + rom_size;
+    size_t frames = (size - 3 - rom_size) / 2;
+
+    static const Chip8::Backend backends[] = {
+        Chip8::Backend::Interpreter, Chip8::Backend::Cached, Chip8::Backend::Jit, Chip8::Backend::Aot
+    };
+
+    Machines &m = machines();
+    layoutRom({rom, rom_size}, m.image);
+    std::memset(guest_coverage, 0, sizeof(guest_coverage));
+    m.test.setBackend(backends[flags & 0x3]);
+    m.test.setFastForward(!(flags & 0x4));
+    m.test.reset(m.image);
+    play(m.test, keys, frames);
+
+    if (flags & 0x8) {
+        m.reference.reset(m.image);
+        play(m.reference, keys, frames);
+
+        Chip8State a, b;
+        m.test.saveState(a);
+        m.reference.saveState(b);
+        if (std::memcmp(&a, &b, sizeof(a)) != 0) {
+            std::cerr << "backend " << (flags & 0x3) << " ended in another state than the interpreter" << std::endl;
+            std::abort();
+        }
+    }
+    return 0;
+}
+
+#ifdef CHIPS_FUZZ_MAIN
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " input..." << std::endl;
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        std::ifstream in(argv[i], std::ios::in | std::ios::binary);
+        if (!in) {
+            std::cerr << "can't read " << argv[i] << std::endl;
+            return 1;
+        }
+        std::vector<uint8_t> input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+
+        size_t pcs = 0, classes = 0;
+        for (size_t j = 0; j < MEM_SIZE; j++) {
+            pcs += guest_coverage[j] != 0;
+        }
+        for (size_t j = MEM_SIZE; j < FUZZ_COVERAGE_SIZE; j++) {
+            classes += guest_coverage[j] != 0;
+        }
+        std::cout << argv[i] << ": " << pcs << " pcs, " << classes << " opcode classes" << std::endl;
+    }
+    return 0;
+}
+#endif
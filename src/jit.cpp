@@ -0,0 +1,715 @@
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <utility>
+
+#include "jit.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// register use inside a block:
+//   rdi - Context*
+//   rsi - v (ctx->v)
+//   rdx - &index (ctx->index)
+//   rbx - ctx->budget, loaded and stored back by the entry stub
+//   eax, ecx - scratch
+// a call to ctx->step or ctx->live saves rdi on the stack, which also aligns it for the
+// call, and reloads rsi and rdx after it. rbx survives it, it's callee-saved.
+static_assert(offsetof(Jit::Context, v) == 0);
+static_assert(offsetof(Jit::Context, index) == 8);
+static_assert(offsetof(Jit::Context, pc) == 16);
+static_assert(offsetof(Jit::Context, budget) == 24);
+static_assert(offsetof(Jit::Context, step) == 32);
+static_assert(offsetof(Jit::Context, machine) == 40);
+static_assert(offsetof(Jit::Context, polled) == 48);
+static_assert(offsetof(Jit::Context, delay_timer) == 56);
+static_assert(offsetof(Jit::Context, keys) == 64);
+static_assert(offsetof(Jit::Context, stack) == 72);
+static_assert(offsetof(Jit::Context, sp) == 80);
+static_assert(offsetof(Jit::Context, fast_forward) == 88);
+static_assert(offsetof(Jit::Context, live) == 96);
+static_assert(STACK_SIZE == 16 && NUM_KEYS == 16, "the stack and key indexes are masked with 15");
+
+namespace {
+
+class Emitter {
+private:
+    uint8_t *buf;
+    size_t &pos;
+public:
+    Emitter(uint8_t *buf, size_t &pos) : buf(buf), pos(pos) {}
+
+    size_t at() const { return pos; }
+    void byte(uint8_t b) { buf[pos++] = b; }
+    void word(uint16_t w) { byte(w & 0xFF); byte(w >> 8); }
+    void dword(uint32_t d) { word(d & 0xFFFF); word(d >> 16); }
+
+    // <op> [rsi + x] with reg in the modrm reg field, V registers are bytes at rsi + x.
+    void vreg(uint8_t op, uint8_t reg, uint8_t x) { byte(op); byte(0x46 | (reg << 3)); byte(x); }
+    void vreg2(uint8_t op, uint8_t reg, uint8_t x) { byte(0x0F); vreg(op, reg, x); }
+
+    void loadAl(uint8_t x) { vreg(0x8A, 0, x); }      // mov al, [rsi + x]
+    void storeAl(uint8_t x) { vreg(0x88, 0, x); }     // mov [rsi + x], al
+    void zextEax(uint8_t x) { vreg2(0xB6, 0, x); }    // movzx eax, byte [rsi + x]
+    void zextEcx(uint8_t x) { vreg2(0xB6, 1, x); }    // movzx ecx, byte [rsi + x]
+    void field(uint8_t reg, uint8_t off) { byte(0x48); byte(0x8B); byte(0x47 | (reg << 3)); byte(off); } // mov reg, [rdi + off]
+};
+
+// how an instruction is compiled. the ones after STEP end a block.
+enum Kind {
+    NONE,     // not at all, Fx0A
+    INLINE,   // register-only, see translate()
+    STEP,     // through ctx->step, falls through to the next instruction
+    JUMP,     // 1nnn
+    SKIP,     // 3xkk, 4xkk, 5xy0, 9xy0, compared inline
+    CALL,     // 2nnn, pushed inline, then on to nnn
+    DYNAMIC,  // 00EE and Bnnn, the target is only known at run time
+    KEY_SKIP, // Ex9E and ExA1, one of two exits
+    STORE,    // Fx33 and Fx55 through ctx->step, they may have dropped this very block
+    INVALID,  // through ctx->step like STORE. ends the block, what follows is likely data
+    LIVE      // anything at a rewritten address, see Jit::rewritten. through ctx->live, then the pc it left
+};
+
+Kind kind(uint16_t opcode) {
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if ((opcode & 0x0FFF) == 0x00E0) return STEP;
+            if ((opcode & 0x0FFF) == 0x00EE) return DYNAMIC;
+            return INVALID;
+        case 0x1000: return JUMP;
+        case 0x2000: return CALL;
+        case 0x3000:
+        case 0x4000:
+        case 0x5000:
+        case 0x9000:
+            return SKIP;
+        case 0x6000:
+        case 0x7000:
+        case 0xA000:
+            return INLINE;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0: case 0x1: case 0x2: case 0x3: case 0x4:
+                case 0x5: case 0x6: case 0x7: case 0xE:
+                    return INLINE;
+            }
+            return INVALID;
+        case 0xB000: return DYNAMIC;
+        case 0xC000:
+        case 0xD000:
+            return STEP;
+        case 0xE000:
+            return (opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1 ? KEY_SKIP : INVALID;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x07: case 0x15: case 0x1E: case 0x29: return INLINE;
+                case 0x18: case 0x65: return STEP;
+                case 0x33: case 0x55: return STORE;
+                case 0x0A: return NONE;
+            }
+            return INVALID;
+    }
+    return INVALID;
+}
+
+
+// body of one instruction, same semantics (and flag write order) as Chip8::interpret().
+void translate(Emitter &e, uint16_t opcode) {
+    uint8_t x = (opcode & 0x0F00) >> 8;
+    uint8_t y = (opcode & 0x00F0) >> 4;
+    uint8_t kk = opcode & 0x00FF;
+
+    switch (opcode & 0xF000) {
+        case 0x6000: // mov byte [rsi + x], kk
+            e.vreg(0xC6, 0, x);
+            e.byte(kk);
+            break;
+        case 0x7000: // add byte [rsi + x], kk
+            e.vreg(0x80, 0, x);
+            e.byte(kk);
+            break;
+        case 0xA000: // mov word [rdx], nnn
+            e.byte(0x66); e.byte(0xC7); e.byte(0x02);
+            e.word(opcode & 0x0FFF);
+            break;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0:
+                    e.loadAl(y);
+                    e.storeAl(x);
+                    break;
+                case 0x1: // or [rsi + x], al
+                    e.loadAl(y);
+                    e.vreg(0x08, 0, x);
+                    break;
+                case 0x2: // and [rsi + x], al
+                    e.loadAl(y);
+                    e.vreg(0x20, 0, x);
+                    break;
+                case 0x3: // xor [rsi + x], al
+                    e.loadAl(y);
+                    e.vreg(0x30, 0, x);
+                    break;
+                case 0x4:
+                    e.zextEax(x);
+                    e.zextEcx(y);
+                    e.byte(0x01); e.byte(0xC8);                           // add eax, ecx
+                    e.byte(0x3D); e.dword(UINT8_MAX);                     // cmp eax, 255
+                    e.byte(0x0F); e.byte(0x97); e.byte(0xC0);             // seta al
+                    e.storeAl(0xF);
+                    e.loadAl(y);
+                    e.vreg(0x00, 0, x);                                   // add [rsi + x], al
+                    break;
+                case 0x5:
+                    e.zextEax(x);
+                    e.zextEcx(y);
+                    e.byte(0x39); e.byte(0xC8);                           // cmp eax, ecx
+                    e.byte(0x0F); e.byte(0x97); e.byte(0xC0);             // seta al
+                    e.storeAl(0xF);
+                    e.loadAl(y);
+                    e.vreg(0x28, 0, x);                                   // sub [rsi + x], al
+                    break;
+                case 0x6:
+                    e.loadAl(x);
+                    e.byte(0x24); e.byte(0x01);                           // and al, 1
+                    e.storeAl(0xF);
+                    e.vreg(0xD0, 5, x);                                   // shr byte [rsi + x], 1
+                    break;
+                case 0x7:
+                    e.zextEax(x);
+                    e.zextEcx(y);
+                    e.byte(0x39); e.byte(0xC8);                           // cmp eax, ecx
+                    e.byte(0x0F); e.byte(0x92); e.byte(0xC0);             // setb al
+                    e.storeAl(0xF);
+                    e.loadAl(y);
+                    e.vreg(0x2A, 0, x);                                   // sub al, [rsi + x]
+                    e.storeAl(x);
+                    break;
+                case 0xE:
+                    e.loadAl(x);
+                    e.byte(0xC0); e.byte(0xE8); e.byte(0x07);             // shr al, 7
+                    e.storeAl(0xF);
+                    e.vreg(0xD0, 4, x);                                   // shl byte [rsi + x], 1
+                    break;
+            }
+            break;
+        case 0xF000:
+            switch (kk) {
+                case 0x07:
+                    e.field(0, 56);                                       // mov rax, ctx->delay_timer
+                    e.byte(0x8A); e.byte(0x00);                           // mov al, [rax]
+                    e.storeAl(x);
+                    e.field(0, 48);                                       // mov rax, ctx->polled
+                    e.byte(0xC6); e.byte(0x00); e.byte(0x01);             // mov byte [rax], 1
+                    break;
+                case 0x15:
+                    e.loadAl(x);
+                    e.field(1, 56);                                       // mov rcx, ctx->delay_timer
+                    e.byte(0x88); e.byte(0x01);                           // mov [rcx], al
+                    break;
+                case 0x1E:
+                    e.zextEax(x);
+                    e.byte(0x66); e.byte(0x01); e.byte(0x02);             // add word [rdx], ax
+                    break;
+                case 0x29:
+                    e.zextEax(x);
+                    e.byte(0x8D); e.byte(0x44); e.byte(0x80); e.byte(FONT_ADDR); // lea eax, [rax + rax*4 + FONT_ADDR]
+                    e.byte(0x66); e.byte(0x89); e.byte(0x02);             // mov word [rdx], ax
+                    break;
+            }
+            break;
+    }
+}
+
+// exit stub: mov word [rdi + 16], pc; ret. 7 bytes, room for a 5 byte jmp once linked.
+void emitStub(Emitter &e, uint16_t pc) {
+    e.byte(0x66); e.byte(0xC7); e.byte(0x47); e.byte(0x10);
+    e.word(pc);
+    e.byte(0xC3);
+}
+
+// ax = ctx->step(ctx, pc, opcode), then v and &index back in rsi and rdx.
+void emitStep(Emitter &e, uint16_t pc, uint16_t opcode) {
+    e.byte(0x57);                                                        // push rdi
+    e.byte(0xBE); e.dword(pc);                                           // mov esi, pc
+    e.byte(0xBA); e.dword(opcode);                                       // mov edx, opcode
+    e.byte(0xFF); e.byte(0x57); e.byte(0x20);                            // call [rdi + 32]
+    e.byte(0x5F);                                                        // pop rdi
+    e.byte(0x48); e.byte(0x8B); e.byte(0x37);                            // mov rsi, [rdi]
+    e.byte(0x48); e.byte(0x8B); e.byte(0x57); e.byte(0x08);              // mov rdx, [rdi + 8]
+}
+
+// ax = ctx->live(ctx, pc), the same for an instruction that may have changed.
+void emitLive(Emitter &e, uint16_t pc) {
+    e.byte(0x57);                                                        // push rdi
+    e.byte(0xBE); e.dword(pc);                                           // mov esi, pc
+    e.byte(0xFF); e.byte(0x57); e.byte(0x60);                            // call [rdi + 96]
+    e.byte(0x5F);                                                        // pop rdi
+    e.byte(0x48); e.byte(0x8B); e.byte(0x37);                            // mov rsi, [rdi]
+    e.byte(0x48); e.byte(0x8B); e.byte(0x57); e.byte(0x08);              // mov rdx, [rdi + 8]
+}
+
+// push(ret), same wrapping as Chip8::push().
+void emitPush(Emitter &e, uint16_t ret) {
+    e.field(1, 80);                                                      // mov rcx, ctx->sp
+    e.byte(0x8A); e.byte(0x01);                                          // mov al, [rcx]
+    e.byte(0xFE); e.byte(0xC0);                                          // inc al
+    e.byte(0x88); e.byte(0x01);                                          // mov [rcx], al
+    e.byte(0x0F); e.byte(0xB6); e.byte(0xC0);                            // movzx eax, al
+    e.byte(0x83); e.byte(0xE0); e.byte(0x0F);                            // and eax, 15
+    e.field(1, 72);                                                      // mov rcx, ctx->stack
+    e.byte(0x66); e.byte(0xC7); e.byte(0x04); e.byte(0x41); e.word(ret); // mov word [rcx + rax*2], ret
+}
+
+// eax = pop(), same wrapping as Chip8::pop().
+void emitPop(Emitter &e) {
+    e.field(1, 80);                                                      // mov rcx, ctx->sp
+    e.byte(0x0F); e.byte(0xB6); e.byte(0x01);                            // movzx eax, byte [rcx]
+    e.byte(0xFE); e.byte(0x09);                                          // dec byte [rcx]
+    e.byte(0x83); e.byte(0xE0); e.byte(0x0F);                            // and eax, 15
+    e.field(1, 72);                                                      // mov rcx, ctx->stack
+    e.byte(0x0F); e.byte(0xB7); e.byte(0x04); e.byte(0x41);              // movzx eax, word [rcx + rax*2]
+}
+
+// exit to the pc in ax: on into its block if it has one, else back to the caller.
+void emitDynamicExit(Emitter &e, const void *blocks) {
+    e.byte(0x0F); e.byte(0xB7); e.byte(0xC0);                            // movzx eax, ax
+    e.byte(0x66); e.byte(0x89); e.byte(0x47); e.byte(0x10);              // mov [rdi + 16], ax
+    e.byte(0x3D); e.dword(MEM_SIZE - 1);                                 // cmp eax, MEM_SIZE - 1
+    e.byte(0x73); e.byte(21);                                            // jae ret
+    e.byte(0x48); e.byte(0xB9);                                          // mov rcx, blocks
+    uint64_t table = reinterpret_cast<uint64_t>(blocks);
+    e.dword(table & 0xFFFFFFFF); e.dword(table >> 32);
+    e.byte(0x48); e.byte(0x8B); e.byte(0x0C); e.byte(0xC1);              // mov rcx, [rcx + rax*8]
+    e.byte(0x48); e.byte(0x85); e.byte(0xC9);                            // test rcx, rcx
+    e.byte(0x74); e.byte(0x02);                                          // jz ret
+    e.byte(0xFF); e.byte(0xE1);                                          // jmp rcx
+    e.byte(0xC3);                                                        // ret
+}
+
+// jmp rel32 at offset at of the buffer to offset target.
+void patchJump(uint8_t *code, size_t at, size_t target) {
+    int32_t rel = static_cast<int32_t>(target - (at + 5));
+    code[at] = 0xE9;
+    std::memcpy(code + at + 1, &rel, sizeof(rel));
+}
+
+// the rel32 of a jcc emitted earlier, at offset at, to offset target.
+void patchRel(uint8_t *code, size_t at, size_t target) {
+    int32_t rel = static_cast<int32_t>(target - (at + 4));
+    std::memcpy(code + at, &rel, sizeof(rel));
+}
+
+// an inline or step instruction at pc.
+void emitBody(Emitter &e, uint16_t opcode, uint16_t pc) {
+    if (kind(opcode) == INLINE) {
+        translate(e, opcode);
+    } else {
+        emitStep(e, pc, opcode);
+    }
+}
+
+// compare for a skip and jump if it's taken. returns where the rel32 of
+// that jump is, for patchRel().
+size_t emitSkip(Emitter &e, uint16_t opcode) {
+    uint8_t x = (opcode & 0x0F00) >> 8;
+    uint8_t y = (opcode & 0x00F0) >> 4;
+    bool taken_if_equal;
+    switch (opcode & 0xF000) {
+        case 0xE000: // sets polled like the interpreter, after the compare
+            e.zextEax(x);
+            e.byte(0x83); e.byte(0xE0); e.byte(0x0F);                    // and eax, 15
+            e.field(1, 64);                                              // mov rcx, ctx->keys
+            e.byte(0x80); e.byte(0x3C); e.byte(0x01); e.byte(0x00);      // cmp byte [rcx + rax], 0
+            e.field(0, 48);                                              // mov rax, ctx->polled
+            e.byte(0xC6); e.byte(0x00); e.byte(0x01);                    // mov byte [rax], 1
+            taken_if_equal = (opcode & 0x00FF) == 0xA1;                  // up, the key is 0
+            break;
+        case 0x3000:
+        case 0x4000:
+            e.vreg(0x80, 7, x);                                          // cmp byte [rsi + x], kk
+            e.byte(opcode & 0x00FF);
+            taken_if_equal = (opcode & 0xF000) == 0x3000;
+            break;
+        default:
+            e.loadAl(y);
+            e.vreg(0x38, 0, x);                                          // cmp [rsi + x], al
+            taken_if_equal = (opcode & 0xF000) == 0x5000;
+            break;
+    }
+    e.byte(0x0F); e.byte(taken_if_equal ? 0x84 : 0x85);                 // je / jne taken
+    size_t rel = e.at();
+    e.dword(0);
+    return rel;
+}
+
+
+}
+
+Jit::Jit() : code(nullptr), exec(nullptr), used(0) {
+#if JIT_SUPPORTED
+#ifdef __linux__
+    int fd = memfd_create("chips-jit", MFD_CLOEXEC);
+    if (fd >= 0) {
+        if (ftruncate(fd, JIT_CODE_SIZE) == 0) {
+            void *rw = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            void *rx = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+            if (rw != MAP_FAILED && rx != MAP_FAILED) {
+                code = static_cast<uint8_t *>(rw);
+                exec = static_cast<uint8_t *>(rx);
+            } else {
+                if (rw != MAP_FAILED) {
+                    munmap(rw, JIT_CODE_SIZE);
+                }
+                if (rx != MAP_FAILED) {
+                    munmap(rx, JIT_CODE_SIZE);
+                }
+            }
+        }
+        close(fd);
+    }
+#endif
+    if (!code) {
+        // one mapping, flipped to executable once here to check the host
+        // allows it at all (hardened kernels, selinux execmem). if not, no jit.
+        void *mapping = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping != MAP_FAILED) {
+            code = exec = static_cast<uint8_t *>(mapping);
+            if (!setWritable(false)) {
+                release();
+            }
+        }
+    }
+#endif
+    flush();
+}
+
+Jit::~Jit() {
+    release();
+}
+
+void Jit::release() {
+#if JIT_SUPPORTED
+    if (exec && exec != code) {
+        munmap(exec, JIT_CODE_SIZE);
+    }
+    if (code) {
+        munmap(code, JIT_CODE_SIZE);
+    }
+#endif
+    code = exec = nullptr;
+}
+
+bool Jit::endsBlock(uint16_t opcode) {
+    Kind k = kind(opcode);
+    return k != INLINE && k != STEP && k != SKIP && k != KEY_SKIP;
+}
+
+bool Jit::setWritable(bool on, size_t from, size_t to) {
+#if JIT_SUPPORTED
+    if (exec != code) {
+        return true; // two views, nothing to flip
+    }
+    // usually a page or two, flipping the whole buffer per block is slow for
+    // roms that keep rewriting their code.
+    const size_t page = 4096;
+    from &= ~(page - 1);
+    to = std::min<size_t>((to + page - 1) & ~(page - 1), JIT_CODE_SIZE);
+    return mprotect(code + from, to - from, on ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#else
+    (void)on;
+    (void)from;
+    (void)to;
+    return false;
+#endif
+}
+
+void Jit::flush() {
+    used = 0;
+    std::memset(blocks, 0, sizeof(blocks));
+    std::memset(lengths, 0, sizeof(lengths));
+    std::memset(covering, 0, sizeof(covering));
+    std::memset(rewritten, 0, sizeof(rewritten));
+    for (std::vector<size_t> &to : exits) {
+        to.clear();
+    }
+    if (!code) {
+        return;
+    }
+
+    // the entry stub run() calls, at the start of the buffer:
+    // void entry(Context *ctx, Block block).
+    if (!setWritable(true, 0, JIT_ENTRY_SIZE)) {
+        release();
+        return;
+    }
+    Emitter e(code, used);
+    e.byte(0x53);                                                        // push rbx
+    e.byte(0x48); e.byte(0x8B); e.byte(0x5F); e.byte(0x18);              // mov rbx, [rdi + 24]
+    e.byte(0x48); e.byte(0x89); e.byte(0xF0);                            // mov rax, rsi
+    e.byte(0x48); e.byte(0x8B); e.byte(0x37);                            // mov rsi, [rdi]
+    e.byte(0x48); e.byte(0x8B); e.byte(0x57); e.byte(0x08);              // mov rdx, [rdi + 8]
+    e.byte(0xFF); e.byte(0xD0);                                          // call rax
+    e.byte(0x48); e.byte(0x89); e.byte(0x5F); e.byte(0x18);              // mov [rdi + 24], rbx
+    e.byte(0x5B);                                                        // pop rbx
+    e.byte(0xC3);                                                        // ret
+    used = JIT_ENTRY_SIZE;
+    if (!setWritable(false, 0, JIT_ENTRY_SIZE)) {
+        release();
+    }
+}
+
+void Jit::invalidate(uint16_t addr, uint16_t len) {
+    for (int a = addr; a < addr + len; a++) {
+        if (covering[a] == 0) {
+            continue;
+        }
+        if (rewritten[a] < UINT8_MAX) {
+            rewritten[a]++;
+        }
+        // a block that covers a starts at most 2 * JIT_MAX_BLOCK - 1 bytes before it.
+        for (int start = std::max(0, a - 2 * JIT_MAX_BLOCK + 1); start <= a; start++) {
+            if (blocks[start] && start + 2 * lengths[start] > a) {
+                drop(start);
+            }
+        }
+    }
+}
+
+void Jit::drop(uint16_t pc) {
+    for (int a = pc; a < pc + 2 * lengths[pc]; a++) {
+        covering[a]--;
+    }
+    blocks[pc] = nullptr;
+    lengths[pc] = 0;
+
+    // the exits that jumped here return to the caller again. the code itself
+    // stays, the block may be the one that's running (it just stored into
+    // itself) and it will return through its exit.
+    if (exits[pc].empty()) {
+        return;
+    }
+    auto [from, to] = std::minmax_element(exits[pc].begin(), exits[pc].end());
+    // can't fail short of running out of mappings, the range was writable before.
+    setWritable(true, *from, *to + 7);
+    for (size_t at : exits[pc]) {
+        Emitter e(code, at);
+        emitStub(e, pc);
+    }
+    setWritable(false, *from, *to + 7);
+}
+
+void Jit::emitExit(uint16_t target, bool chain) {
+    size_t at = used;
+    Emitter e(code, used);
+    emitStub(e, target);
+    if (chain && target < MEM_SIZE) {
+        exits[target].push_back(at);
+        if (blocks[target]) {
+            patchJump(code, at, blocks[target] - exec);
+        }
+    }
+}
+
+void Jit::emitJump(uint16_t at, uint16_t opcode) {
+    // with fast-forward on, back to the caller if something was polled or
+    // it's a jump to itself.
+    uint16_t target = opcode & 0x0FFF;
+    Emitter e(code, used);
+    e.byte(0x80); e.byte(0x7F); e.byte(0x58); e.byte(0x00);             // cmp byte [rdi + 88], 0
+    if (target == at) {
+        e.byte(0x74); e.byte(0x02);                                     // je over the jmp
+        e.byte(0xEB); e.byte(0x07);                                     // jmp over the linked exit
+    } else {
+        e.byte(0x74); e.byte(0x09);                                     // je over the poll check
+        e.field(0, 48);                                                 // mov rax, ctx->polled
+        e.byte(0x80); e.byte(0x38); e.byte(0x00);                       // cmp byte [rax], 0
+        e.byte(0x75); e.byte(0x07);                                     // jne over the linked exit
+    }
+    emitExit(target, true);
+    emitExit(target, false);
+}
+
+Jit::Block Jit::compile(uint16_t pc, const uint16_t *opcodes, int count) {
+    // code the rom keeps storing into runs through the interpreter, which
+    // reads it fresh, instead of being compiled again after every store.
+    auto kindAt = [&](int i) {
+        uint16_t a = pc + 2 * i;
+        if (rewritten[a] >= JIT_LIVE_AFTER || rewritten[a + 1] >= JIT_LIVE_AFTER) {
+            return LIVE;
+        }
+        return kind(opcodes[i]);
+    };
+
+    // find the extent of the block first. an exit instruction ends it and is
+    // part of it, anything that can't be compiled ends it without being part
+    // of it. a skip over an inline or step instruction doesn't end it, and a
+    // skip over a jump or call ends it with that as a third exit.
+    int len = 0;
+    Kind end = NONE;
+    bool guarded = false; // end is a skip, and the jump or call after it is in the block
+    while (len < count) {
+        Kind k = kindAt(len);
+        if (k == NONE) {
+            break;
+        }
+        len++;
+        if (k == INLINE || k == STEP) {
+            continue;
+        }
+        if ((k == SKIP || k == KEY_SKIP) && len < count) {
+            Kind next = kindAt(len);
+            if (next == INLINE || next == STEP) {
+                len++;
+                continue;
+            }
+            if (next == JUMP || next == CALL) {
+                len++;
+                guarded = true;
+            }
+        }
+        end = k;
+        break;
+    }
+    if (len == 0) {
+        return nullptr;
+    }
+
+    // worst case is 8xy4 at 27 bytes per instruction, plus its budget
+    // check and stub, and the exits.
+    size_t worst = 64 * (len + 2);
+    if (used + worst > JIT_CODE_SIZE) {
+        flush();
+    }
+    // writable while the block is emitted and older exits are linked to it.
+    size_t write_from = used, write_to = used + worst;
+    for (size_t at : exits[pc]) {
+        write_from = std::min(write_from, at);
+    }
+    if (!setWritable(true, write_from, write_to)) {
+        return nullptr;
+    }
+
+    size_t start = used;
+    Emitter e(code, used);
+
+    // every instruction takes one from the budget first, and leaves through
+    // a stub at the end of the block if there was none left. a skipped
+    // instruction is jumped over along with its check.
+    std::pair<size_t, uint16_t> out[JIT_MAX_BLOCK]; // rel32 of each check, pc
+    int outs = 0;
+    auto tick = [&](uint16_t a) {
+        e.byte(0x48); e.byte(0xFF); e.byte(0xCB);                        // dec rbx
+        e.byte(0x0F); e.byte(0x88);                                      // js out
+        out[outs++] = {e.at(), a};
+        e.dword(0);
+    };
+
+    int body = len - (end == NONE ? 0 : guarded ? 2 : 1);
+    for (int i = 0; i < body; i++) {
+        uint16_t opcode = opcodes[i];
+        uint16_t a = pc + 2 * i;
+        tick(a);
+        if (kind(opcode) == SKIP || kind(opcode) == KEY_SKIP) {
+            size_t taken_rel = emitSkip(e, opcode);
+            i++;
+            tick(a + 2);
+            emitBody(e, opcodes[i], a + 2);
+            patchRel(code, taken_rel, used);
+        } else {
+            emitBody(e, opcode, a);
+        }
+    }
+    // a live instruction isn't covered, storing into it drops nothing.
+    int covered = end == LIVE ? len - 1 : len;
+    for (int a = pc; a < pc + 2 * covered; a++) {
+        covering[a]++;
+    }
+
+    // register the block before emitting the exits, so a jump to itself links directly.
+    blocks[pc] = exec + start;
+    lengths[pc] = covered;
+
+    uint16_t at = pc + 2 * body; // of the exit instruction
+    uint16_t last = opcodes[body];
+    if (end != NONE) {
+        tick(at);
+    }
+    switch (end) {
+        case NONE: // ran into Fx0A, runJit() takes it from there
+            emitExit(at, true);
+            break;
+        case JUMP:
+            emitJump(at, last);
+            break;
+        case CALL:
+            emitPush(e, at + 2);
+            emitExit(last & 0x0FFF, true);
+            break;
+        case DYNAMIC:
+            if ((last & 0xF000) == 0xB000) {
+                e.byte(0x0F); e.byte(0xB6); e.byte(0x06);               // movzx eax, byte [rsi]
+                e.byte(0x05); e.dword(last & 0x0FFF);                   // add eax, nnn
+                e.byte(0x25); e.dword(MEM_SIZE - 1);                    // and eax, MEM_SIZE - 1
+            } else {
+                emitPop(e);
+            }
+            emitDynamicExit(e, blocks);
+            break;
+        case STORE: // if it dropped this block, the exit was unlinked with it
+        case INVALID:
+            emitStep(e, at, last);
+            emitExit(at + 2, true);
+            break;
+        case LIVE:
+            emitLive(e, at);
+            emitDynamicExit(e, blocks);
+            break;
+        case SKIP:
+        case KEY_SKIP: { // the next instruction is at at + 2, a taken skip lands on at + 4
+            size_t taken_rel = emitSkip(e, last);
+            if (guarded) {
+                uint16_t over = opcodes[body + 1];
+                tick(at + 2);
+                if (kind(over) == JUMP) {
+                    emitJump(at + 2, over);
+                } else {
+                    emitPush(e, at + 4);
+                    emitExit(over & 0x0FFF, true);
+                }
+            } else {
+                emitExit(at + 2, true);
+            }
+            patchRel(code, taken_rel, used);
+            emitExit(at + 4, true);
+            break;
+        }
+        default:
+            break;
+    }
+
+    // out of budget: inc rbx back to 0, then the stub for the pc it stopped at.
+    for (int i = 0; i < outs; i++) {
+        patchRel(code, out[i].first, used);
+        e.byte(0x48); e.byte(0xFF); e.byte(0xC3);
+        emitStub(e, out[i].second);
+    }
+
+    // link the exits of earlier blocks that were waiting for this one.
+    for (size_t site : exits[pc]) {
+        patchJump(code, site, start);
+    }
+    if (!setWritable(false, write_from, write_to)) {
+        // can't run what was just written, give up on the jit for good.
+        release();
+        flush();
+        return nullptr;
+    }
+    return blocks[pc];
+}
@@ -0,0 +1,125 @@
+#ifndef CHIPS_JIT
+#define CHIPS_JIT
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "chip8.hpp"
+
+#define JIT_CODE_SIZE (1 << 20) // bytes of executable memory, flushed when full
+#define JIT_MAX_BLOCK 64        // max instructions per block
+#define JIT_ENTRY_SIZE 32       // bytes at the start of the buffer for the entry stub
+#define JIT_LIVE_AFTER 2        // stores that dropped blocks over a byte before it's interpreted
+
+// basic-block recompiler for x86-64 hosts.
+//
+// a block is a straight run of instructions starting at some pc. everything
+// that only touches registers, the timers, keys and stack is compiled inline,
+// the rest (00E0, Cxkk, Dxyn, Fx18, Fx65, invalid opcodes) calls back into
+// the machine through Context::step, which runs one instruction there. a
+// jump, skip, call, return, Bnnn, store (Fx33, Fx55) or invalid opcode ends
+// the block and becomes its exits. only Fx0A is never compiled, a block
+// stops in front of it. blocks jump straight into each other, through the block table for
+// 00EE and Bnnn, so loops stay in native code until the cycle budget runs out.
+// it's checked per instruction, a run stops where the decode cache's would
+// and the next one starts a block from there.
+// with fast-forward on, like the decode cache's 1nnn, a jump to itself or
+// taken after the timer or keys were polled goes back to the caller instead.
+//
+// every write to guest memory goes through invalidate(). only the blocks
+// compiled from the written bytes are dropped, and the exits that jumped
+// into them go back to returning to the caller. an instruction the rom
+// keeps rewriting ends up interpreted in place, through live.
+class Jit {
+public:
+    // pinned context block. generated code keeps a pointer to it in rdi,
+    // the offsets below are baked into the emitted instructions.
+    struct Context {
+        uint8_t *v;      // +0
+        uint16_t *index; // +8
+        uint16_t pc;     // +16, written on every exit
+        int64_t budget;  // +24, instructions left, every instruction takes one
+        // +32, runs opcode as the instruction at pc on machine and returns the
+        // next pc. called with this context, it may call invalidate().
+        uint16_t (*step)(void *ctx, uint16_t pc, uint16_t opcode);
+        void *machine;   // +40, for step
+        bool *polled;    // +48, set by Fx07, Ex9E and ExA1, see Chip8::skipIdle()
+        uint8_t *delay_timer; // +56
+        const bool *keys;     // +64
+        uint16_t *stack;      // +72
+        uint8_t *sp;          // +80
+        bool fast_forward;    // +88
+        uint16_t (*live)(void *ctx, uint16_t pc); // +96, step with the opcode read from pc
+    };
+    typedef const uint8_t *Block; // entered through run()
+
+private:
+    // the code buffer is never writable and executable at once. where the host
+    // has memfd it's mapped twice, code read/write and exec read/exec. else
+    // it's one mapping (exec == code) that compile() flips to read/write and
+    // back around the pages it writes. both nullptr if the host can't run
+    // generated code.
+    uint8_t *code;
+    uint8_t *exec;
+    size_t used;
+
+    Block blocks[MEM_SIZE];        // compiled block per start address
+    uint8_t lengths[MEM_SIZE];     // its instructions, less a live one at the end
+    uint8_t covering[MEM_SIZE];    // blocks compiled from each guest byte
+    uint8_t rewritten[MEM_SIZE];   // stores to each guest byte that dropped a block, saturating
+
+    // offsets of the exits that go to each pc. each is a stub returning to
+    // the caller, with a jmp over it while the pc has a block. exits of
+    // dropped blocks stay listed until the next flush(), a block may still
+    // be running when it's dropped.
+    std::vector<size_t> exits[MEM_SIZE];
+
+    Block compile(uint16_t pc, const uint16_t *opcodes, int count);
+    bool setWritable(bool on, size_t from = 0, size_t to = JIT_CODE_SIZE); // the pages covering code[from, to)
+    void release();
+    void emitExit(uint16_t target, bool chain);
+    void emitJump(uint16_t at, uint16_t opcode); // the exits of the 1nnn at at
+    void drop(uint16_t pc);
+public:
+    Jit();
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    bool available() const { return code != nullptr; }
+    static bool endsBlock(uint16_t opcode); // nothing after it goes in the same block
+
+    // compiles on first use, nullptr if it can't. read(addr) gives the guest
+    // byte at addr, it's only called on a miss.
+    template <typename Read>
+    Block lookup(uint16_t pc, Read read) {
+        if (!code || pc >= MEM_SIZE - 1) {
+            return nullptr;
+        }
+        if (blocks[pc]) {
+            return blocks[pc];
+        }
+
+        // everything a block starting here could cover.
+        uint16_t opcodes[JIT_MAX_BLOCK];
+        int count = 0;
+        for (uint16_t addr = pc; count < JIT_MAX_BLOCK && addr + 1 < MEM_SIZE; addr += 2) {
+            opcodes[count] = (read(addr) << 8) | read(addr + 1);
+            if (endsBlock(opcodes[count++])) {
+                break;
+            }
+        }
+        return compile(pc, opcodes, count);
+    }
+
+    // runs block and whatever it jumps into, until an exit back to here.
+    void run(Block block, Context *ctx) const {
+        reinterpret_cast<void (*)(Context *, Block)>(exec)(ctx, block);
+    }
+
+    void invalidate(uint16_t addr, uint16_t len = 1); // the guest bytes [addr, addr + len), no wrapping
+    void flush();
+};
+
+#endif
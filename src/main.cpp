@@ -1,8 +1,15 @@
 #include <iostream> 
+#include <string>
+#include <cstdlib>
+#include <random>
 #include <SDL2/SDL.h>
 
 #include "chip8.hpp"
 #include "console.hpp"
+#include "scheduler.hpp"
+#include "rewind.hpp"
+#include "trace.hpp"
+#include "observe.hpp"
 
 #define OK 1
 #define FAIL 0
@@ -10,25 +17,112 @@
 #define WINDOW_WIDTH 64 * SCALE
 #define WINDOW_HEIGHT 32 * SCALE
 
+static void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [--ips N] [--uncapped] [--rewind-mb N] [--seed N]\n"
+              << "       [--record TRACE] [--observe SHM_NAME] [--observe-log FILE] path/to/rom_file" << std::endl;
+}
+
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " path/to/rom_file" << std::endl;
+    uint32_t ips = DEFAULT_IPS;
+    bool uncapped = false;
+    size_t rewind_budget = REWIND_BUDGET;
+    uint64_t seed = std::random_device{}(); // a new game every time unless asked otherwise
+    const char *rom_file = nullptr;
+    const char *record_file = nullptr;
+    const char *observe = nullptr;
+    const char *observe_log = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--ips" && i + 1 < argc) {
+            ips = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--rewind-mb" && i + 1 < argc) {
+            rewind_budget = std::strtoull(argv[++i], nullptr, 10) << 20; // 0 turns it off
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--record" && i + 1 < argc) {
+            record_file = argv[++i];
+        } else if (arg == "--observe" && i + 1 < argc) {
+            observe = argv[++i];
+        } else if (arg == "--observe-log" && i + 1 < argc) {
+            observe_log = argv[++i];
+        } else if (arg == "--uncapped") {
+            uncapped = true;
+        } else if (!rom_file && arg[0] != '-') {
+            rom_file = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!rom_file || ips == 0) {
+        usage(argv[0]);
         return 1;
     }
     
     Console* console = new Console("Chips - a chip-8 interpreter", WINDOW_WIDTH, WINDOW_HEIGHT);
     Chip8* cpu = new Chip8();
+    cpu->setSeed(seed);
 
-    if(!cpu->loadRom(argv[1])) {
+    if(!cpu->loadRom(rom_file)) {
         return FAIL;
     } else {
         std::cout << "rom file loaded." << std::endl;
     }
 
-    console->run(cpu);
+    Scheduler scheduler(cpu, ips);
+    if (uncapped) {
+        scheduler.setMode(Scheduler::Mode::Uncapped);
+    }
+
+    Rewind *rewind = nullptr;
+    if (rewind_budget > 0 && !record_file) {
+        rewind = new Rewind(rewind_budget);
+    }
+
+    InputTrace *recording = nullptr;
+    if (record_file) {
+        recording = new InputTrace();
+        recording->seed = seed;
+        recording->ips = ips;
+        recording->rom_hash = romHash(*cpu);
+    }
+
+    FrameStream *stream = nullptr;
+    if (observe || observe_log) {
+        stream = new FrameStream();
+        if ((observe && !stream->openShared(observe)) || (observe_log && !stream->openLog(observe_log))) {
+            return FAIL;
+        }
+    }
+
+    console->run(cpu, &scheduler, rewind, recording, stream);
+
+    int status = OK;
+    if (stream) {
+        if (!stream->close()) {
+            status = FAIL;
+        }
+        delete stream;
+    }
+    if (recording) {
+        // the final screen is always a checkpoint.
+        uint64_t frames = scheduler.getFrameCount();
+        if (recording->checkpoints.empty() || recording->checkpoints.back().frame != frames) {
+            recording->addCheckpoint(frames, frameHash(cpu->getGraphics()));
+        }
+        if (recording->save(record_file)) {
+            std::cout << "recorded " << frames << " frames to " << record_file << std::endl;
+        } else {
+            status = FAIL;
+        }
+        delete recording;
+    }
 
     delete console;
+    delete rewind;
     delete cpu;
 
-    return OK;
+    return status;
 }
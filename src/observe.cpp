@@ -0,0 +1,244 @@
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "observe.hpp"
+#include "delta.hpp"
+
+namespace {
+
+const size_t LOG_HEADER_SIZE = 4 * sizeof(uint32_t);
+
+std::string shmName(const std::string &name) {
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+}
+
+void observeFrame(const Chip8& chips, uint64_t frame, uint64_t cycles, ObservedFrame& out) {
+    out.frame = frame;
+    out.cycles = cycles;
+    std::memcpy(out.graphics, chips.getGraphics(), sizeof(out.graphics));
+    std::memcpy(out.stack, chips.getStack(), sizeof(out.stack));
+    std::memcpy(out.v, chips.getRegisters(), sizeof(out.v));
+    out.index = chips.getIndex();
+    out.pc = chips.getPC();
+    out.keys = chips.getKeys();
+    out.sp = chips.getSP();
+    out.delay_timer = chips.getDelayTimer();
+    out.sound_timer = chips.getSoundTimer();
+    std::memset(out.reserved, 0, sizeof(out.reserved));
+}
+
+FrameStream::FrameStream() : ring(nullptr), last(), scratch(), delta(deltaMaxSize(sizeof(ObservedFrame))) {
+}
+
+FrameStream::~FrameStream() {
+    close();
+}
+
+bool FrameStream::openShared(const std::string& shm_name) {
+    std::string path = shmName(shm_name);
+    int fd = shm_open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "failed to create shared memory " << path << "." << std::endl;
+        return false;
+    }
+    void *mapped = MAP_FAILED;
+    if (ftruncate(fd, sizeof(ObserveRing)) == 0) {
+        mapped = mmap(nullptr, sizeof(ObserveRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "failed to map shared memory " << path << "." << std::endl;
+        shm_unlink(path.c_str());
+        return false;
+    }
+
+    // the segment comes zeroed: every seq even, nothing published. the header
+    // goes last so a reader that checks magic sees a finished one.
+    ring = static_cast<ObserveRing*>(mapped);
+    ring->version = OBSERVE_VERSION;
+    ring->slots = OBSERVE_SLOTS;
+    ring->frame_size = sizeof(ObservedFrame);
+    ring->magic.store(OBSERVE_MAGIC, std::memory_order_release);
+    name = path;
+    return true;
+}
+
+bool FrameStream::openLog(const std::string& log_file) {
+    log.open(log_file, std::ios::out | std::ios::binary | std::ios::trunc);
+    uint32_t header[4] = {OBSERVE_LOG_MAGIC, OBSERVE_VERSION, sizeof(ObservedFrame), 0};
+    log.write(reinterpret_cast<const char*>(header), sizeof(header));
+    if (!log) {
+        std::cerr << "failed to write " << log_file << "." << std::endl;
+        log.close();
+        return false;
+    }
+    std::memset(&last, 0, sizeof(last));
+    return true;
+}
+
+void FrameStream::publish(const Chip8& chips, uint64_t frame, uint64_t cycles) {
+    const ObservedFrame *observed = &scratch;
+    if (ring) {
+        uint64_t n = ring->published.load(std::memory_order_relaxed);
+        ObserveSlot &slot = ring->slot[n % OBSERVE_SLOTS];
+        uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release); // odd seq before any of the frame
+        observeFrame(chips, frame, cycles, slot.frame);
+        slot.seq.store(seq + 2, std::memory_order_release);
+        ring->published.store(n + 1, std::memory_order_release);
+        observed = &slot.frame; // only this thread writes it, reading it back is safe
+    } else if (log.is_open()) {
+        observeFrame(chips, frame, cycles, scratch);
+    }
+
+    if (log.is_open()) {
+        uint32_t size = deltaEncode(reinterpret_cast<const uint8_t*>(&last), reinterpret_cast<const uint8_t*>(observed),
+                                    sizeof(ObservedFrame), delta.data());
+        log.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        log.write(reinterpret_cast<const char*>(delta.data()), size);
+        last = *observed;
+    }
+}
+
+bool FrameStream::close() {
+    bool ok = true;
+    if (log.is_open()) {
+        log.flush();
+        ok = bool(log);
+        if (!ok) {
+            std::cerr << "failed to write the frame log." << std::endl;
+        }
+        log.close();
+    }
+    if (ring) {
+        ring->closed.store(1, std::memory_order_release);
+        munmap(ring, sizeof(ObserveRing));
+        shm_unlink(name.c_str());
+        ring = nullptr;
+        name.clear();
+    }
+    return ok;
+}
+
+FrameReader::FrameReader() : ring(nullptr) {
+}
+
+FrameReader::~FrameReader() {
+    if (ring) {
+        munmap(const_cast<ObserveRing*>(ring), sizeof(ObserveRing));
+    }
+}
+
+bool FrameReader::open(const std::string& shm_name) {
+    std::string path = shmName(shm_name);
+    int fd = shm_open(path.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << "no shared memory named " << path << "." << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(ObserveRing)) {
+        std::cerr << path << " is not a chips frame ring." << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, sizeof(ObserveRing), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "failed to map shared memory " << path << "." << std::endl;
+        return false;
+    }
+
+    const ObserveRing *r = static_cast<const ObserveRing*>(mapped);
+    if (r->magic.load(std::memory_order_acquire) != OBSERVE_MAGIC || r->version != OBSERVE_VERSION
+        || r->slots != OBSERVE_SLOTS || r->frame_size != sizeof(ObservedFrame)) {
+        std::cerr << path << " is not a chips frame ring, or from another version." << std::endl;
+        munmap(mapped, sizeof(ObserveRing));
+        return false;
+    }
+    if (ring) {
+        munmap(const_cast<ObserveRing*>(ring), sizeof(ObserveRing));
+    }
+    ring = r;
+    return true;
+}
+
+FrameView FrameReader::latest() const {
+    FrameView view = {nullptr, nullptr, 0};
+    if (!ring) {
+        return view;
+    }
+    // an odd seq means the writer lapped the ring since published was read,
+    // which only happens to a reader that was descheduled. look again.
+    for (;;) {
+        uint64_t n = ring->published.load(std::memory_order_acquire);
+        if (n == 0) {
+            return view;
+        }
+        const ObserveSlot &slot = ring->slot[(n - 1) % OBSERVE_SLOTS];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq % 2 == 0) {
+            view.frame = &slot.frame;
+            view.seq = &slot.seq;
+            view.ticket = seq;
+            return view;
+        }
+    }
+}
+
+bool FrameReader::read(ObservedFrame& out) const {
+    for (;;) {
+        FrameView view = latest();
+        if (!view.frame) {
+            return false;
+        }
+        std::memcpy(&out, view.frame, sizeof(out));
+        if (view.valid()) {
+            return true;
+        }
+    }
+}
+
+uint64_t FrameReader::published() const {
+    return ring ? ring->published.load(std::memory_order_acquire) : 0;
+}
+
+bool FrameReader::closed() const {
+    return !ring || ring->closed.load(std::memory_order_acquire) != 0;
+}
+
+bool FrameLogReader::open(const std::string& log_file) {
+    in.open(log_file, std::ios::in | std::ios::binary);
+    uint32_t header[4];
+    if (!in.read(reinterpret_cast<char*>(header), LOG_HEADER_SIZE)) {
+        std::cerr << "failed to read " << log_file << "." << std::endl;
+        return false;
+    }
+    if (header[0] != OBSERVE_LOG_MAGIC || header[1] != OBSERVE_VERSION || header[2] != sizeof(ObservedFrame)) {
+        std::cerr << log_file << " is not a chips frame log, or from another version." << std::endl;
+        return false;
+    }
+    std::memset(&current, 0, sizeof(current));
+    delta.resize(deltaMaxSize(sizeof(ObservedFrame)));
+    return true;
+}
+
+bool FrameLogReader::next(ObservedFrame& out) {
+    uint32_t size;
+    if (!in.read(reinterpret_cast<char*>(&size), sizeof(size)) || size > delta.size()
+        || !in.read(reinterpret_cast<char*>(delta.data()), size)) {
+        return false;
+    }
+    if (!deltaApply(reinterpret_cast<uint8_t*>(&current), sizeof(current), delta.data(), size)) {
+        return false;
+    }
+    out = current;
+    return true;
+}
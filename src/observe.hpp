@@ -0,0 +1,140 @@
+#ifndef CHIPS_OBSERVE
+#define CHIPS_OBSERVE
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <fstream>
+#include <vector>
+
+#include "chip8.hpp"
+
+#define OBSERVE_MAGIC 0x4f384843 // "CH8O" read as a little-endian uint32_t
+#define OBSERVE_LOG_MAGIC 0x4c384843 // "CH8L"
+#define OBSERVE_VERSION 1
+#define OBSERVE_SLOTS 8 // frames in the shared ring, a reader has this long to finish with one
+
+// a finished frame as other processes see it: the display, registers,
+// timers and where the run is. fixed layout with no pointers, like
+// Chip8State, host byte order.
+struct ObservedFrame {
+    uint64_t frame;  // frames completed, see Scheduler::getFrameCount()
+    uint64_t cycles; // cycles run
+    uint64_t graphics[SCREEN_HEIGHT];
+    uint16_t stack[STACK_SIZE];
+    uint8_t v[NUM_REGS];
+    uint16_t index;
+    uint16_t pc;
+    uint16_t keys;   // the mask the frame ran with
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t reserved[7]; // zero, pads the size to a multiple of 8
+};
+
+static_assert(std::is_trivially_copyable_v<ObservedFrame>);
+static_assert(sizeof(ObservedFrame) % 8 == 0);
+
+void observeFrame(const Chip8& chips, uint64_t frame, uint64_t cycles, ObservedFrame& out);
+
+// the shared memory segment, a ring of the last OBSERVE_SLOTS frames.
+//
+// every slot is a seqlock: the writer bumps seq to odd, fills the frame and
+// bumps it to even again, and a reader that saw the same even seq before
+// and after looking at a slot knows it read a whole frame. the writer never
+// waits on readers, and since it goes round the ring, a slot it just
+// published stays put for the next OBSERVE_SLOTS - 1 frames. that's long
+// enough for a reader to work on it in place and only check seq afterwards.
+struct ObserveSlot {
+    alignas(64) std::atomic<uint64_t> seq;
+    ObservedFrame frame;
+};
+
+struct ObserveRing {
+    std::atomic<uint32_t> magic;          // set last, once the rest of the header is
+    uint32_t version;
+    uint32_t slots;
+    uint32_t frame_size;                  // sizeof(ObservedFrame), a layout check for readers
+    alignas(64) std::atomic<uint64_t> published; // frames so far, the newest is in slot (published - 1) % slots
+    std::atomic<uint32_t> closed;         // the writer is gone, nothing more is coming
+    ObserveSlot slot[OBSERVE_SLOTS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring is shared between processes");
+
+// publishes every frame it's given to a shared ring (openShared) and/or
+// appends it to a log file (openLog), for trainers and dashboards in other
+// processes. meant to run once per frame from Scheduler::setFrameCallback.
+// the ring costs one copy of the frame into shared memory and two stores,
+// the log an xor delta against the previous frame (see delta.hpp) into a
+// buffered file, usually a few dozen bytes.
+//
+// log layout, host byte order: uint32 magic, uint32 version, uint32 frame
+// size, uint32 reserved, then per frame uint32 length and the delta of the
+// frame against the one before it (against all zeroes for the first).
+class FrameStream {
+private:
+    std::string name;    // of the shared segment, empty if none
+    ObserveRing *ring;
+    std::ofstream log;
+    ObservedFrame last;  // for the log's deltas
+    ObservedFrame scratch;
+    std::vector<uint8_t> delta;
+public:
+    FrameStream();
+    ~FrameStream(); // closes the log and removes the segment, attached readers keep their mapping
+    FrameStream(const FrameStream&) = delete;
+    FrameStream& operator=(const FrameStream&) = delete;
+
+    // name is a POSIX shm name ("/chips-pong"), the leading slash is optional.
+    // an existing segment of that name is replaced.
+    bool openShared(const std::string& shm_name);
+    bool openLog(const std::string& log_file);
+    void publish(const Chip8& chips, uint64_t frame, uint64_t cycles);
+    bool close(); // false if the log couldn't be written
+};
+
+// a frame in the ring, read in place. check valid() once done with it: if
+// it's false the writer came round again meanwhile and what was read is junk.
+struct FrameView {
+    const ObservedFrame *frame; // nullptr if nothing was published yet
+    const std::atomic<uint64_t> *seq;
+    uint64_t ticket;
+
+    bool valid() const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return frame && seq->load(std::memory_order_relaxed) == ticket;
+    }
+};
+
+// the other end of FrameStream::openShared(), in any process. never writes
+// to the segment, never blocks the writer.
+class FrameReader {
+private:
+    const ObserveRing *ring;
+public:
+    FrameReader();
+    ~FrameReader();
+    FrameReader(const FrameReader&) = delete;
+    FrameReader& operator=(const FrameReader&) = delete;
+
+    bool open(const std::string& shm_name);
+    FrameView latest() const;           // the newest frame, in place
+    bool read(ObservedFrame& out) const; // a copy of the newest frame, false if none yet
+    uint64_t published() const;
+    bool closed() const;
+};
+
+// reads a FrameStream log back frame by frame.
+class FrameLogReader {
+private:
+    std::ifstream in;
+    ObservedFrame current;
+    std::vector<uint8_t> delta;
+public:
+    bool open(const std::string& log_file);
+    bool next(ObservedFrame& out); // false at the end, or on a damaged record
+};
+
+#endif
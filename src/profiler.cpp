@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <cstdio>
+
+#include "profiler.hpp"
+
+namespace {
+
+const char *const CLASS_NAMES[Profiler::NUM_CLASSES] = {
+    "00E0 CLS", "00EE RET", "0nnn SYS", "1nnn JP", "2nnn CALL", "3xkk SE", "4xkk SNE", "5xy0 SE",
+    "6xkk LD", "7xkk ADD", "8xy0 LD", "8xy1 OR", "8xy2 AND", "8xy3 XOR", "8xy4 ADD", "8xy5 SUB",
+    "8xy6 SHR", "8xy7 SUBN", "8xyE SHL", "9xy0 SNE", "Annn LD I", "Bnnn JP V0", "Cxkk RND",
+    "Dxyn DRW", "Ex9E SKP", "ExA1 SKNP", "Fx07 LD DT", "Fx0A LD K", "Fx15 LD DT", "Fx18 LD ST",
+    "Fx1E ADD I", "Fx29 LD F", "Fx33 LD B", "Fx55 LD [I]", "Fx65 LD [I]", "invalid"
+};
+
+std::string hex4(uint16_t value) {
+    char buf[8];
+    std::snprintf(buf, sizeof(buf), "%04x", value);
+    return buf;
+}
+
+}
+
+Profiler::OpClass Profiler::classify(uint16_t opcode) {
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00E0) return CLS;
+            if (opcode == 0x00EE) return RET;
+            return SYS;
+        case 0x1000: return JP;
+        case 0x2000: return CALL;
+        case 0x3000: return SE_IMM;
+        case 0x4000: return SNE_IMM;
+        case 0x5000: return SE_REG;
+        case 0x6000: return LD_IMM;
+        case 0x7000: return ADD_IMM;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0: return LD_REG;
+                case 0x1: return OR;
+                case 0x2: return AND;
+                case 0x3: return XOR;
+                case 0x4: return ADD_REG;
+                case 0x5: return SUB;
+                case 0x6: return SHR;
+                case 0x7: return SUBN;
+                case 0xE: return SHL;
+            }
+            return INVALID;
+        case 0x9000: return SNE_REG;
+        case 0xA000: return LD_I;
+        case 0xB000: return JP_V0;
+        case 0xC000: return RND;
+        case 0xD000: return DRW;
+        case 0xE000:
+            if ((opcode & 0x00FF) == 0x9E) return SKP;
+            if ((opcode & 0x00FF) == 0xA1) return SKNP;
+            return INVALID;
+        default:
+            switch (opcode & 0x00FF) {
+                case 0x07: return LD_VX_DT;
+                case 0x0A: return LD_VX_K;
+                case 0x15: return LD_DT_VX;
+                case 0x18: return LD_ST_VX;
+                case 0x1E: return ADD_I;
+                case 0x29: return LD_F;
+                case 0x33: return LD_B;
+                case 0x55: return LD_MEM_VX;
+                case 0x65: return LD_VX_MEM;
+            }
+            return INVALID;
+    }
+}
+
+const char* Profiler::className(OpClass op) {
+    return CLASS_NAMES[op];
+}
+
+Profiler::Profiler() {
+    reset();
+}
+
+void Profiler::reset() {
+    instructions = 0;
+    std::memset(class_count, 0, sizeof(class_count));
+    std::memset(class_ns, 0, sizeof(class_ns));
+    std::memset(class_samples, 0, sizeof(class_samples));
+    std::memset(pc_count, 0, sizeof(pc_count));
+    draw_calls = 0;
+    sprite_rows = 0;
+    key_wait_spins = 0;
+    run_ns = 0;
+    last_pc = 0xFFFF;
+    last_opcode = 0;
+    pending_class = -1;
+    nodes.assign(1, {0, START_ADDR, 0, 0});
+    children.clear();
+    current = 0;
+}
+
+void Profiler::record(uint16_t pc, uint16_t opcode) {
+    OpClass op = classify(opcode);
+
+    // close the sampled instruction before this one.
+    if (pending_class >= 0) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - pending_start).count();
+        class_ns[pending_class] += ns;
+        class_samples[pending_class]++;
+        pending_class = -1;
+    }
+
+    instructions++;
+    class_count[op]++;
+    pc_count[pc & (MEM_SIZE - 1)]++;
+    nodes[current].count++;
+
+    switch (op) {
+        case DRW:
+            draw_calls++;
+            sprite_rows += opcode & 0x000F;
+            break;
+        case LD_VX_K:
+            // Fx0A rewinds pc while no key is down, so a spin shows up as
+            // the same instruction twice in a row.
+            if (pc == last_pc && opcode == last_opcode) {
+                key_wait_spins++;
+            }
+            break;
+        case CALL: {
+            uint16_t target = opcode & 0x0FFF;
+            // the guest stack wraps at STACK_SIZE, so calls that never return
+            // (menus that 2nnn into each other) would grow the tree forever.
+            // past that depth the shadow stack starts over from the root.
+            uint32_t parent = nodes[current].depth < STACK_SIZE ? current : 0;
+            uint64_t key = (uint64_t(parent) << 16) | target;
+            auto it = children.find(key);
+            if (it == children.end()) {
+                nodes.push_back({parent, target, uint16_t(nodes[parent].depth + 1), 0});
+                it = children.emplace(key, uint32_t(nodes.size() - 1)).first;
+            }
+            current = it->second;
+            break;
+        }
+        case RET:
+            current = nodes[current].parent;
+            break;
+        default:
+            break;
+    }
+    last_pc = pc;
+    last_opcode = opcode;
+
+    if (instructions % PROFILE_SAMPLE_PERIOD == 0) {
+        pending_class = op;
+        pending_start = Clock::now();
+    }
+}
+
+void Profiler::beginRun() {
+    run_start = Clock::now();
+}
+
+void Profiler::endRun() {
+    // a sample can't span two run() calls, whatever the caller does in
+    // between isn't the instruction's time.
+    pending_class = -1;
+    run_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - run_start).count();
+}
+
+uint64_t Profiler::getInstructions() const {
+    return instructions;
+}
+
+std::string Profiler::stackName(uint32_t node) const {
+    std::string name;
+    for (;;) {
+        std::string frame = node == 0 ? "main" : "sub_" + hex4(nodes[node].addr);
+        name = name.empty() ? frame : frame + ";" + name;
+        if (node == 0) {
+            return name;
+        }
+        node = nodes[node].parent;
+    }
+}
+
+void Profiler::report(std::ostream &out, const uint8_t *mem, size_t top) const {
+    out << "instructions: " << instructions << '\n';
+    if (instructions > 0) {
+        out << "run time: " << run_ns << " ns (" << std::fixed << std::setprecision(2)
+            << double(run_ns) / instructions << " ns/instr, profiling included)\n";
+    }
+
+    std::vector<int> order;
+    for (int op = 0; op < NUM_CLASSES; op++) {
+        if (class_count[op] > 0) {
+            order.push_back(op);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return class_count[a] > class_count[b]; });
+
+    out << "\nopcode class        count       %    ns (sampled)\n";
+    for (int op : order) {
+        out << std::left << std::setw(14) << CLASS_NAMES[op] << std::right
+            << std::setw(14) << class_count[op]
+            << std::setw(8) << std::setprecision(2) << 100.0 * class_count[op] / instructions;
+        if (class_samples[op] > 0) {
+            out << std::setw(12) << std::setprecision(1) << double(class_ns[op]) / class_samples[op];
+        } else {
+            out << std::setw(12) << "-";
+        }
+        out << '\n';
+    }
+
+    std::vector<uint16_t> hot;
+    for (uint16_t addr = 0; addr < MEM_SIZE; addr++) {
+        if (pc_count[addr] > 0) {
+            hot.push_back(addr);
+        }
+    }
+    size_t shown = std::min(top, hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + shown, hot.end(),
+                      [&](uint16_t a, uint16_t b) { return pc_count[a] > pc_count[b]; });
+
+    out << "\nhot addresses\n";
+    for (size_t i = 0; i < shown; i++) {
+        uint16_t addr = hot[i];
+        uint16_t opcode = (mem[addr] << 8) | mem[(addr + 1) & (MEM_SIZE - 1)];
+        out << "  " << hex4(addr) << "  " << hex4(opcode) << "  " << std::left << std::setw(14)
+            << CLASS_NAMES[classify(opcode)] << std::right << std::setw(14) << pc_count[addr]
+            << std::setw(8) << std::setprecision(2) << 100.0 * pc_count[addr] / instructions << '\n';
+    }
+
+    out << "\ndraw calls: " << draw_calls << " sprite rows: " << sprite_rows;
+    if (draw_calls > 0) {
+        out << " (" << std::setprecision(2) << double(sprite_rows) / draw_calls << " per draw)";
+    }
+    out << "\nFx0A spins: " << key_wait_spins << '\n';
+    out << std::defaultfloat;
+}
+
+void Profiler::reportJson(std::ostream &out, const uint8_t *mem) const {
+    out << "{\"instructions\":" << instructions
+        << ",\"run_ns\":" << run_ns
+        << ",\"draw_calls\":" << draw_calls
+        << ",\"sprite_rows\":" << sprite_rows
+        << ",\"key_wait_spins\":" << key_wait_spins
+        << ",\"classes\":[";
+    bool first = true;
+    for (int op = 0; op < NUM_CLASSES; op++) {
+        if (class_count[op] == 0) {
+            continue;
+        }
+        out << (first ? "" : ",") << "{\"class\":\"" << CLASS_NAMES[op] << "\",\"count\":" << class_count[op]
+            << ",\"sampled_ns\":" << class_ns[op] << ",\"samples\":" << class_samples[op] << "}";
+        first = false;
+    }
+    out << "],\"addresses\":[";
+    first = true;
+    for (uint16_t addr = 0; addr < MEM_SIZE; addr++) {
+        if (pc_count[addr] == 0) {
+            continue;
+        }
+        uint16_t opcode = (mem[addr] << 8) | mem[(addr + 1) & (MEM_SIZE - 1)];
+        out << (first ? "" : ",") << "{\"pc\":\"" << hex4(addr) << "\",\"opcode\":\"" << hex4(opcode)
+            << "\",\"count\":" << pc_count[addr] << "}";
+        first = false;
+    }
+    out << "]}\n";
+}
+
+void Profiler::collapsedStacks(std::ostream &out) const {
+    for (uint32_t node = 0; node < nodes.size(); node++) {
+        if (nodes[node].count > 0) {
+            out << stackName(node) << ' ' << nodes[node].count << '\n';
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef CHIPS_PROFILER
+#define CHIPS_PROFILER
+
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+
+#include "chip8.hpp"
+
+#define PROFILE_SAMPLE_PERIOD 1024 // time one instruction out of this many
+
+// counts what a Chip8 executes. only built in with -DCHIPS_PROFILE=ON
+// (PROFILER_ENABLED), otherwise the hooks in chip8.cpp compile to nothing
+// and an attached Profiler stays empty.
+//
+// everything comes from one hook per instruction, record(pc, opcode), called
+// before the instruction runs:
+//  - executions per opcode class and per address
+//  - draw calls (Dxyn) and the sprite rows they draw
+//  - Fx0A spins, i.e. the same Fx0A executed again without a key
+//  - host time, by timing every PROFILE_SAMPLE_PERIOD-th instruction from its
+//    fetch to the next fetch (dispatch included)
+//  - a shadow call stack from 2nnn/00EE, for flamegraph.pl style collapsed
+//    stacks with one frame per subroutine address
+//
+// the jit runs whole blocks natively with no hook, so an attached profiler
+// makes Backend::Jit run as Backend::Cached.
+#ifdef CHIPS_PROFILE
+constexpr bool PROFILER_ENABLED = true;
+#else
+constexpr bool PROFILER_ENABLED = false;
+#endif
+
+class Profiler {
+public:
+    enum OpClass {
+        CLS, RET, SYS, JP, CALL, SE_IMM, SNE_IMM, SE_REG, LD_IMM, ADD_IMM,
+        LD_REG, OR, AND, XOR, ADD_REG, SUB, SHR, SUBN, SHL, SNE_REG,
+        LD_I, JP_V0, RND, DRW, SKP, SKNP, LD_VX_DT, LD_VX_K, LD_DT_VX, LD_ST_VX,
+        ADD_I, LD_F, LD_B, LD_MEM_VX, LD_VX_MEM, INVALID,
+        NUM_CLASSES
+    };
+
+    static OpClass classify(uint16_t opcode);
+    static const char* className(OpClass op);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    uint64_t instructions;
+    uint64_t class_count[NUM_CLASSES];
+    uint64_t class_ns[NUM_CLASSES];      // sampled time
+    uint64_t class_samples[NUM_CLASSES];
+    uint64_t pc_count[MEM_SIZE];
+    uint64_t draw_calls;
+    uint64_t sprite_rows;
+    uint64_t key_wait_spins;
+    uint64_t run_ns;                     // inside Chip8::run(), hooks included
+
+    uint16_t last_pc;
+    uint16_t last_opcode;
+    int pending_class;                   // sampled instruction waiting for its end time, -1 if none
+    Clock::time_point pending_start;
+    Clock::time_point run_start;
+
+    // call tree, node 0 is the code outside any subroutine.
+    struct Node {
+        uint32_t parent;
+        uint16_t addr;
+        uint16_t depth;  // calls below it, at most STACK_SIZE
+        uint64_t count;  // instructions executed with this node on top
+    };
+    std::vector<Node> nodes;
+    std::unordered_map<uint64_t, uint32_t> children; // (node << 16 | addr) -> child
+    uint32_t current;
+
+    std::string stackName(uint32_t node) const;
+public:
+    Profiler();
+
+    void record(uint16_t pc, uint16_t opcode);
+    void beginRun();
+    void endRun();
+    void reset();
+
+    uint64_t getInstructions() const;
+    void report(std::ostream &out, const uint8_t *mem, size_t top = 20) const; // human readable
+    void reportJson(std::ostream &out, const uint8_t *mem) const;
+    void collapsedStacks(std::ostream &out) const; // for flamegraph.pl
+};
+
+#endif
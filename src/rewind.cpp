@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cstring>
+
+#include "rewind.hpp"
+#include "delta.hpp"
+
+namespace {
+
+const Chip8State ZERO_STATE = {};
+
+inline const uint8_t* bytesOf(const Chip8State& state) {
+    return reinterpret_cast<const uint8_t*>(&state);
+}
+
+inline uint8_t* bytesOf(Chip8State& state) {
+    return reinterpret_cast<uint8_t*>(&state);
+}
+
+}
+
+Rewind::Rewind(size_t budget, uint32_t keyframe_interval)
+    : ring(std::max(budget, 2 * deltaMaxSize(sizeof(Chip8State)))),
+      head(0),
+      bytes(0),
+      keyframe_interval(std::max<uint32_t>(keyframe_interval, 1)),
+      since_keyframe(0),
+      scratch(deltaMaxSize(sizeof(Chip8State))) {
+}
+
+void Rewind::popFront() {
+    bytes -= entries.front().size;
+    entries.pop_front();
+    // the deltas up to the next keyframe are useless without this one.
+    while (!entries.empty() && !entries.front().keyframe) {
+        bytes -= entries.front().size;
+        entries.pop_front();
+    }
+}
+
+bool Rewind::push(size_t size, bool keyframe) {
+    size_t offset = head;
+    if (offset + size > ring.size()) {
+        // no room before the end, whatever still lives past head is the oldest.
+        while (!entries.empty() && entries.front().offset >= head) {
+            popFront();
+        }
+        offset = 0;
+    }
+    while (!entries.empty() && entries.front().offset < offset + size
+           && offset < entries.front().offset + entries.front().size) {
+        popFront();
+    }
+    if (entries.empty() && !keyframe) {
+        return false; // lost its base, the caller writes a keyframe instead
+    }
+
+    std::memcpy(ring.data() + offset, scratch.data(), size);
+    entries.push_back({offset, uint32_t(size), keyframe});
+    head = offset + size;
+    bytes += size;
+    return true;
+}
+
+void Rewind::capture(const Chip8& chips) {
+    chips.saveState(current);
+
+    bool keyframe = entries.empty() || since_keyframe >= keyframe_interval;
+    const Chip8State& base = keyframe ? ZERO_STATE : last;
+    size_t size = deltaEncode(bytesOf(base), bytesOf(current), sizeof(Chip8State), scratch.data());
+    if (!push(size, keyframe)) {
+        keyframe = true;
+        size = deltaEncode(bytesOf(ZERO_STATE), bytesOf(current), sizeof(Chip8State), scratch.data());
+        push(size, true);
+    }
+
+    since_keyframe = keyframe ? 1 : since_keyframe + 1;
+    last = current;
+}
+
+bool Rewind::decode(size_t target, Chip8State& state) const {
+    // nearest keyframe at or before target, then forward through the deltas.
+    size_t key = target;
+    while (!entries[key].keyframe) {
+        key--;
+    }
+
+    state = ZERO_STATE;
+    for (size_t i = key; i <= target; i++) {
+        const Entry &entry = entries[i];
+        if (!deltaApply(bytesOf(state), sizeof(Chip8State), ring.data() + entry.offset, entry.size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Rewind::get(uint32_t k, Chip8State& state) const {
+    if (k >= entries.size()) {
+        return false;
+    }
+    if (k == 0) {
+        state = last;
+        return true;
+    }
+    return decode(entries.size() - 1 - k, state);
+}
+
+bool Rewind::restore(Chip8& chips, uint32_t k) {
+    Chip8State state;
+    if (!get(k, state) || !chips.loadState(state)) {
+        return false;
+    }
+
+    // the frames after the restored one are gone, capturing picks up from here.
+    for (uint32_t i = 0; i < k; i++) {
+        bytes -= entries.back().size;
+        entries.pop_back();
+    }
+    head = entries.back().offset + entries.back().size;
+    since_keyframe = 0;
+    for (auto it = entries.rbegin(); !it->keyframe; it++) {
+        since_keyframe++;
+    }
+    since_keyframe++;
+    last = state;
+    return true;
+}
+
+size_t Rewind::frames() const {
+    return entries.size();
+}
+
+size_t Rewind::used() const {
+    return bytes;
+}
+
+void Rewind::clear() {
+    entries.clear();
+    head = 0;
+    bytes = 0;
+    since_keyframe = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef CHIPS_REWIND
+#define CHIPS_REWIND
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+
+#include "chip8.hpp"
+
+#define REWIND_BUDGET (4 << 20)      // bytes of history kept by default
+#define REWIND_KEYFRAME_INTERVAL 60  // a full snapshot every this many frames
+
+// history of past machine states for stepping backwards.
+//
+// capture() is meant to run once per frame (Scheduler::setFrameCallback).
+// every frame stores the xor delta (see delta.hpp) of its Chip8State against
+// the previous frame, and every keyframe_interval frames a keyframe stores the
+// whole state (as a delta against an all-zero state, which squeezes out the
+// empty memory). a typical frame costs a few dozen bytes and a couple of
+// microseconds, so it can stay on all the time.
+//
+// entries live in one fixed ring of budget bytes, the oldest get dropped when
+// it's full. deltas are only usable after their keyframe, so dropping a
+// keyframe drops the deltas that follow it too. the budget should fit a few
+// keyframe intervals.
+class Rewind {
+private:
+    struct Entry {
+        size_t offset;  // into ring
+        uint32_t size;
+        bool keyframe;
+    };
+
+    std::vector<uint8_t> ring;
+    std::deque<Entry> entries; // oldest first, the front is always a keyframe
+    size_t head;               // where the next entry goes
+    size_t bytes;              // in use by entries
+    uint32_t keyframe_interval;
+    uint32_t since_keyframe;   // entries since the last keyframe, that one included
+
+    Chip8State last;           // newest captured state
+    Chip8State current;
+    std::vector<uint8_t> scratch;
+
+    bool push(size_t size, bool keyframe);
+    void popFront();
+    bool decode(size_t target, Chip8State& state) const;
+public:
+    Rewind(size_t budget = REWIND_BUDGET, uint32_t keyframe_interval = REWIND_KEYFRAME_INTERVAL);
+
+    void capture(const Chip8& chips);
+    bool get(uint32_t k, Chip8State& state) const; // the state k frames before the newest capture
+    bool restore(Chip8& chips, uint32_t k);        // load get(k) and forget the frames after it
+    size_t frames() const;                         // captures available, get() takes k < frames()
+    size_t used() const;
+    void clear();
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef CHIPS_RNG
+#define CHIPS_RNG
+
+#include <cstdint>
+#include <bit>
+
+#define DEFAULT_SEED 0xC8C8C8C8u
+
+// pcg32 (pcg-random.org), the random source for Cxkk. each machine owns one,
+// so instances don't share state and a run repeats exactly from its seed.
+// a step is a multiply-add and a rotate, no syscalls or locks involved.
+#define PCG_MULT 6364136223846793005ull
+#define PCG_INC 1442695040888963407ull // the stream, must be odd
+
+inline uint32_t pcgNext(uint64_t &state) {
+    uint64_t old = state;
+    state = old * PCG_MULT + PCG_INC;
+    uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+    return std::rotr(xorshifted, int(old >> 59));
+}
+
+inline uint64_t pcgSeed(uint64_t seed) {
+    uint64_t state = 0;
+    pcgNext(state);
+    state += seed;
+    pcgNext(state);
+    return state;
+}
+
+#endif
@@ -0,0 +1,188 @@
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "romcache.hpp"
+#include "trace.hpp"
+
+bool checkRomSize(size_t size) {
+    if (size > ROM_MAX_SIZE) {
+        std::cerr << "rom is too big to load, " << size << " bytes (at most " << ROM_MAX_SIZE << ")." << std::endl;
+        return false;
+    } else if (size == 0) {
+        std::cerr << "empty rom detected..." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+RomFileId fileId(const struct stat &info) {
+    return {uint64_t(info.st_dev), uint64_t(info.st_ino),
+            int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec, uint64_t(info.st_size)};
+}
+
+}
+
+bool romFileId(const std::string& path, RomFileId& id) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+    id = fileId(info);
+    return true;
+}
+
+RomFile::RomFile(const std::string& rom_file) : data(nullptr), size(0), file_id() {
+    int fd = open(rom_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "failed to read rom file." << std::endl;
+        return;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        std::cerr << "failed to read rom file." << std::endl;
+        close(fd);
+        return;
+    }
+    if (!checkRomSize(size_t(info.st_size))) {
+        close(fd);
+        return;
+    }
+
+    // the mapping keeps the file alive, the descriptor isn't needed anymore.
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "failed to map rom file." << std::endl;
+        return;
+    }
+    data = static_cast<const uint8_t*>(mapped);
+    size = info.st_size;
+    file_id = fileId(info);
+}
+
+RomFile::~RomFile() {
+    if (data) {
+        munmap(const_cast<uint8_t*>(data), size);
+    }
+}
+
+bool RomFile::ok() const {
+    return data != nullptr;
+}
+
+std::span<const uint8_t> RomFile::bytes() const {
+    return {data, size};
+}
+
+const RomFileId& RomFile::id() const {
+    return file_id;
+}
+
+RomCache& RomCache::shared() {
+    static RomCache cache;
+    return cache;
+}
+
+void layoutRom(std::span<const uint8_t> rom, RomImage &image) {
+    std::memset(image.mem, 0, MEM_SIZE);
+    std::memcpy(image.mem + FONT_ADDR, Chip8::fonts, FONT_SIZE);
+    std::memcpy(image.mem + START_ADDR, rom.data(), rom.size());
+    image.size = rom.size();
+    image.hash = romHash(image.mem);
+}
+
+std::shared_ptr<const RomImage> RomCache::intern(std::shared_ptr<const RomImage> image) {
+    // the hash only picks the bucket, the bytes decide. entries whose image
+    // is gone are dropped on the way.
+    auto [it, end] = by_hash.equal_range(image->hash);
+    while (it != end) {
+        std::shared_ptr<const RomImage> known = it->second.lock();
+        if (!known) {
+            it = by_hash.erase(it);
+            continue;
+        }
+        if (known->size == image->size && std::memcmp(known->mem, image->mem, MEM_SIZE) == 0) {
+            return known;
+        }
+        ++it;
+    }
+    // other buckets only get pruned here, twice the live size apart so it
+    // stays amortized O(1) per insert.
+    if (by_hash.size() >= prune_at) {
+        prune();
+        prune_at = std::max<size_t>(16, 2 * by_hash.size());
+    }
+    by_hash.emplace(image->hash, image);
+    return image;
+}
+
+void RomCache::prune() {
+    for (auto it = by_hash.begin(); it != by_hash.end();) {
+        it = it->second.expired() ? by_hash.erase(it) : std::next(it);
+    }
+}
+
+std::shared_ptr<const RomImage> RomCache::load(const std::string& rom_file) {
+    PathEntry cached = {};
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = by_path.find(rom_file);
+        if (found != by_path.end()) {
+            cached = found->second;
+        }
+    }
+    // a stat per load, the file is only read again if it changed.
+    RomFileId id;
+    if (cached.image && romFileId(rom_file, id) && id == cached.id) {
+        return cached.image;
+    }
+
+    // mapped, checked and laid out without the lock, a slow file only holds
+    // up its own caller. two threads racing on the same path both read it,
+    // intern() hands them the same image.
+    RomFile file(rom_file);
+    if (!file.ok()) {
+        return nullptr;
+    }
+    auto fresh = std::make_shared<RomImage>();
+    layoutRom(file.bytes(), *fresh);
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::shared_ptr<const RomImage> image = intern(fresh);
+    // keyed by the mapped file's own id, a replace between the stat and the
+    // open just means one more read next time.
+    by_path[rom_file] = {file.id(), image};
+    return image;
+}
+
+std::shared_ptr<const RomImage> RomCache::load(std::span<const uint8_t> rom) {
+    if (!checkRomSize(rom.size())) {
+        return nullptr;
+    }
+    auto fresh = std::make_shared<RomImage>();
+    layoutRom(rom, *fresh);
+
+    std::lock_guard<std::mutex> guard(lock);
+    return intern(fresh);
+}
+
+size_t RomCache::size() {
+    std::lock_guard<std::mutex> guard(lock);
+    prune();
+    return by_hash.size();
+}
+
+void RomCache::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    by_path.clear();
+    by_hash.clear();
+}
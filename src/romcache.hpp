@@ -0,0 +1,99 @@
+#ifndef CHIPS_ROMCACHE
+#define CHIPS_ROMCACHE
+
+#include <cstdint>
+#include <string>
+#include <span>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "chip8.hpp"
+
+#define ROM_MAX_SIZE (MEM_SIZE - START_ADDR) // 3584, everything above the interpreter area
+
+// prints why a rom of this size can't be loaded, if it can't.
+bool checkRomSize(size_t size);
+
+// which file a path pointed at and which version of it: a rebuilt or
+// replaced rom differs in at least one of these.
+struct RomFileId {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_ns;
+    uint64_t size;
+
+    bool operator==(const RomFileId&) const = default;
+};
+
+// the id of whatever is at path now, false if it can't be stat'ed.
+bool romFileId(const std::string& path, RomFileId& id);
+
+// a rom file mapped read-only, nothing is copied until it goes into a
+// machine. the size is checked before mapping, so an empty or oversized
+// file costs an open and an fstat. posix only, like the rest of the tree.
+class RomFile {
+private:
+    const uint8_t *data;
+    size_t size;
+    RomFileId file_id;
+public:
+    explicit RomFile(const std::string& rom_file);
+    ~RomFile();
+    RomFile(const RomFile&) = delete;
+    RomFile& operator=(const RomFile&) = delete;
+
+    bool ok() const; // false if it couldn't be opened or the size check failed
+    std::span<const uint8_t> bytes() const;
+    const RomFileId& id() const; // of the file that was mapped
+};
+
+// a validated rom laid out as a machine's whole power-on memory (fonts at
+// FONT_ADDR, rom at START_ADDR, zeros elsewhere), so Chip8::reset() is one
+// copy of mem. immutable once built, shared between machines and threads.
+struct RomImage {
+    uint64_t hash; // romHash() of mem, what traces record
+    size_t size;   // of the rom itself
+    alignas(64) uint8_t mem[MEM_SIZE];
+};
+
+// lays a rom that passed checkRomSize() out as an image, hash included,
+// without interning it. for callers that see every rom once, like fuzzers.
+void layoutRom(std::span<const uint8_t> rom, RomImage &image);
+
+// process-wide, content-addressed store of RomImages. the same bytes give
+// the same image however they got here, and a path is read and validated
+// once however many machines run it, as long as the file there stays the
+// same (device, inode, mtime, size). a rom rebuilt or replaced on disk is
+// read again. thread safe, files are read and laid out outside the lock.
+//
+// paths hold their image, the hash index only points at images: one nobody
+// uses any more (its file was replaced, the span it came from dropped) is
+// freed and its entry pruned.
+class RomCache {
+private:
+    struct PathEntry {
+        RomFileId id;
+        std::shared_ptr<const RomImage> image;
+    };
+
+    std::mutex lock;
+    std::unordered_map<std::string, PathEntry> by_path;
+    std::unordered_multimap<uint64_t, std::weak_ptr<const RomImage>> by_hash;
+    size_t prune_at = 16; // by_hash size that triggers the next full prune()
+
+    // the image already interned with the same bytes, else image itself. lock held.
+    std::shared_ptr<const RomImage> intern(std::shared_ptr<const RomImage> image);
+    void prune(); // drops the entries of freed images. lock held
+public:
+    static RomCache& shared();
+
+    // nullptr if the rom can't be read or fails the size check.
+    std::shared_ptr<const RomImage> load(const std::string& rom_file);
+    std::shared_ptr<const RomImage> load(std::span<const uint8_t> rom);
+
+    size_t size(); // distinct images still in use
+    void clear();  // images already handed out stay valid
+};
+
+#endif
@@ -0,0 +1,449 @@
+// chips-run: headless runner, no SDL involved.
+// loads a rom, runs it at full host speed and dumps the final machine state.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+
+#include "chip8.hpp"
+#include "batch.hpp"
+#include "scheduler.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+#include "romcache.hpp"
+#include "observe.hpp"
+
+static void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [--cycles N | --frames N] [--ips N] [--no-dump] [--lanes N]\n"
+              << "       [--backend interp|cached|jit|aot] [--compare [STEP]]\n"
+              << "       [--load-state FILE] [--save-state FILE] [--seed N] [--profile PREFIX]\n"
+              << "       [--replay TRACE] [--no-fast-forward] [--observe SHM_NAME] [--observe-log FILE]\n"
+              << "       path/to/rom_file" << std::endl;
+}
+
+static void dumpGraphics(const Chip8 &chips) {
+    const uint64_t *graphics = chips.getGraphics();
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            std::cout << (getPixel(graphics, x, y) ? '#' : '.');
+        }
+        std::cout << '\n';
+    }
+}
+
+static void dumpRegisters(const Chip8 &chips) {
+    const uint8_t *v = chips.getRegisters();
+    std::cout << std::hex << std::setfill('0');
+    for (int i = 0; i < NUM_REGS; i++) {
+        std::cout << "V" << std::uppercase << i << std::nouppercase << "=" << std::setw(2) << +v[i]
+                  << (i % 8 == 7 ? '\n' : ' ');
+    }
+    std::cout << "I=" << std::setw(4) << chips.getIndex()
+              << " PC=" << std::setw(4) << chips.getPC()
+              << " SP=" << std::setw(2) << +chips.getSP()
+              << " DT=" << std::setw(2) << +chips.getDelayTimer()
+              << " ST=" << std::setw(2) << +chips.getSoundTimer() << '\n';
+    std::cout << std::dec << std::setfill(' ');
+}
+
+// instructions actually executed per second. fast-forwarded cycles count as
+// run but took no time, leaving them in would make idle roms look fast.
+static double executedRate(uint64_t cycles, uint64_t idle, double secs) {
+    return secs > 0 ? (cycles - idle) / secs : 0.0;
+}
+
+static bool sameState(const Chip8 &a, const Chip8 &b) {
+    const uint64_t *ga = a.getGraphics();
+    const uint64_t *gb = b.getGraphics();
+    uint8_t mem_a[MEM_SIZE], mem_b[MEM_SIZE];
+    a.copyMemory(mem_a);
+    b.copyMemory(mem_b);
+    return std::equal(a.getRegisters(), a.getRegisters() + NUM_REGS, b.getRegisters())
+        && std::equal(a.getStack(), a.getStack() + STACK_SIZE, b.getStack())
+        && std::equal(mem_a, mem_a + MEM_SIZE, mem_b)
+        && std::equal(ga, ga + SCREEN_HEIGHT, gb)
+        && a.getIndex() == b.getIndex() && a.getPC() == b.getPC() && a.getSP() == b.getSP()
+        && a.getDelayTimer() == b.getDelayTimer() && a.getSoundTimer() == b.getSoundTimer();
+}
+
+// differential run: the reference interpreter and the given backend in
+// lockstep, comparing the machine states every step cycles. the jit only
+// runs blocks that fit in one step, so give it a step larger than 1. the
+// reference executes every instruction, so this checks fast-forward too.
+static int runCompare(const char *rom_file, Chip8::Backend backend, uint32_t ips, uint64_t seed, uint64_t cycles, uint64_t step) {
+    Chip8 *ref = new Chip8();
+    Chip8 *test = new Chip8();
+    ref->setSeed(seed);
+    test->setSeed(seed);
+    ref->setBackend(Chip8::Backend::Interpreter);
+    ref->setFastForward(false);
+    test->setBackend(backend);
+    Scheduler ref_scheduler(ref, ips);
+    Scheduler test_scheduler(test, ips);
+
+    int status = 0;
+    if (!ref->loadRom(rom_file) || !test->loadRom(rom_file)) {
+        status = 1;
+    } else {
+        for (uint64_t i = 0; i < cycles; i += step) {
+            uint16_t pc = ref->getPC();
+            ref_scheduler.runCycles(step);
+            test_scheduler.runCycles(step);
+            if (!sameState(*ref, *test)) {
+                std::cout << "mismatch in cycles " << i << "-" << i + step - 1
+                          << " (from pc " << std::hex << pc << std::dec << ")\n"
+                          << "reference:\n";
+                dumpRegisters(*ref);
+                std::cout << "backend:\n";
+                dumpRegisters(*test);
+                status = 2;
+                break;
+            }
+        }
+        if (status == 0) {
+            std::cout << "identical for " << cycles << " cycles" << std::endl;
+        }
+    }
+
+    delete ref;
+    delete test;
+    return status;
+}
+
+// the registers, timers and display lane ended with, against a separate machine.
+static bool sameLane(const Chip8Batch &batch, size_t lane, const Chip8 &chips) {
+    for (int i = 0; i < NUM_REGS; i++) {
+        if (batch.getRegister(lane, i) != chips.getRegisters()[i]) {
+            return false;
+        }
+    }
+    const uint64_t *gb = batch.getGraphics(lane);
+    const uint64_t *gc = chips.getGraphics();
+    return std::equal(gb, gb + SCREEN_HEIGHT, gc)
+        && batch.getIndex(lane) == chips.getIndex() && batch.getPC(lane) == chips.getPC()
+        && batch.getSP(lane) == chips.getSP() && batch.getDelayTimer(lane) == chips.getDelayTimer()
+        && batch.getSoundTimer(lane) == chips.getSoundTimer();
+}
+
+// runs the same rom on N lanes of Chip8Batch and on N separate Chip8
+// instances, and reports the aggregate lane-cycles per second of both.
+// both tick their timers every ips / 60 cycles. afterwards every lane has
+// to match its separate machine, or the run fails.
+static int runLanes(const char *rom_file, size_t lanes, uint32_t ips, uint64_t seed, uint64_t cycles) {
+    const uint64_t frame_cycles = std::max<uint64_t>(ips / TIMER_HZ, 1);
+    Chip8Batch *batch = new Chip8Batch(lanes);
+    batch->setSeed(seed);
+    if (!batch->loadRom(rom_file)) {
+        delete batch;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < cycles; i += frame_cycles) {
+        uint64_t chunk = std::min(frame_cycles, cycles - i);
+        batch->run(chunk);
+        if (chunk == frame_cycles) {
+            batch->timers();
+        }
+    }
+    double batch_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // the rom is read once, every machine starts from the cached image.
+    std::shared_ptr<const RomImage> rom = RomCache::shared().load(rom_file);
+    if (!rom) {
+        delete batch;
+        return 1;
+    }
+    std::vector<Chip8> machines(lanes);
+    for (size_t lane = 0; lane < lanes; lane++) {
+        machines[lane].setSeed(seed + lane);
+        machines[lane].reset(*rom);
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < cycles; i++) {
+        for (auto &machine : machines) {
+            machine.cycle();
+        }
+        if ((i + 1) % frame_cycles == 0) {
+            for (auto &machine : machines) {
+                machine.timers();
+            }
+        }
+    }
+    double single_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double total = double(cycles) * lanes;
+    std::cout << "lanes: " << lanes << " cycles/lane: " << cycles << std::fixed << std::setprecision(0) << '\n'
+              << "batch:    " << std::setprecision(6) << batch_secs << "s "
+              << std::setprecision(0) << total / batch_secs << " lane-cycles/s\n"
+              << "separate: " << std::setprecision(6) << single_secs << "s "
+              << std::setprecision(0) << total / single_secs << " lane-cycles/s" << std::endl;
+
+    int status = 0;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        if (!sameLane(*batch, lane, machines[lane])) {
+            std::cout << "lane " << lane << " differs from its separate machine:\n";
+            dumpRegisters(machines[lane]);
+            std::cout << "batch: PC=" << std::hex << batch->getPC(lane) << " I=" << batch->getIndex(lane)
+                      << std::dec << std::endl;
+            status = 2;
+            break;
+        }
+    }
+    if (status == 0) {
+        std::cout << "all lanes identical to their separate machines" << std::endl;
+    }
+    delete batch;
+    return status;
+}
+
+// replays a recorded trace at full speed with its seed and ips, checking
+// the display against every checkpoint in it.
+static int runReplay(const char *rom_file, const char *trace_file, Chip8::Backend backend, bool fast_forward, bool dump) {
+    InputTrace trace;
+    if (!trace.load(trace_file)) {
+        return 1;
+    }
+    if (trace.ips == 0) {
+        std::cerr << "trace has no instruction rate." << std::endl;
+        return 1;
+    }
+
+    Chip8 *cpu = new Chip8();
+    cpu->setBackend(backend);
+    cpu->setFastForward(fast_forward);
+    cpu->setSeed(trace.seed);
+    if (!cpu->loadRom(rom_file)) {
+        delete cpu;
+        return 1;
+    }
+    if (trace.rom_hash != 0 && trace.rom_hash != romHash(*cpu)) {
+        std::cerr << "warning: the trace was recorded on a different rom." << std::endl;
+    }
+
+    Scheduler scheduler(cpu, trace.ips);
+    scheduler.setMode(Scheduler::Mode::Uncapped);
+
+    TraceCursor cursor(&trace);
+    size_t next_checkpoint = 0;
+    uint64_t passed = 0, failed = 0;
+    cpu->setKeys(cursor.next());
+    scheduler.setFrameCallback([&] {
+        uint64_t frame = scheduler.getFrameCount();
+        while (next_checkpoint < trace.checkpoints.size() && trace.checkpoints[next_checkpoint].frame <= frame) {
+            const InputTrace::Checkpoint &checkpoint = trace.checkpoints[next_checkpoint++];
+            uint64_t hash = frameHash(cpu->getGraphics());
+            if (checkpoint.frame == frame && checkpoint.hash == hash) {
+                passed++;
+            } else {
+                failed++;
+                std::cout << "checkpoint at frame " << checkpoint.frame << " failed: expected "
+                          << std::hex << checkpoint.hash << " got " << hash << std::dec << '\n';
+            }
+        }
+        cpu->setKeys(cursor.next());
+    });
+
+    uint64_t frames = trace.frames();
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < frames; i++) {
+        scheduler.runFrame();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (dump) {
+        dumpGraphics(*cpu);
+        dumpRegisters(*cpu);
+    }
+    std::cout << "replayed frames: " << frames << " (" << std::fixed << std::setprecision(1) << frames / double(TIMER_HZ)
+              << "s of play) cycles: " << scheduler.getCycleCount() << " idle: " << cpu->getIdleCycles()
+              << " time: " << std::setprecision(6) << secs << "s"
+              << " cycles/s: " << std::setprecision(0) << executedRate(scheduler.getCycleCount(), cpu->getIdleCycles(), secs)
+              << " checkpoints: " << passed << " passed, " << failed << " failed" << std::endl;
+
+    delete cpu;
+    return failed > 0 ? 3 : 0;
+}
+
+int main(int argc, char** argv) {
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    uint32_t ips = DEFAULT_IPS;
+    uint64_t seed = DEFAULT_SEED;
+    size_t lanes = 0;
+    bool dump = true;
+    bool compare = false;
+    bool fast_forward = true;
+    uint64_t compare_step = 1;
+    Chip8::Backend backend = Chip8::Backend::Cached;
+    const char *rom_file = nullptr;
+    const char *load_state = nullptr;
+    const char *save_state = nullptr;
+    const char *profile = nullptr;
+    const char *replay = nullptr;
+    const char *observe = nullptr;
+    const char *observe_log = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--cycles" && i + 1 < argc) {
+            cycles = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--frames" && i + 1 < argc) {
+            frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--ips" && i + 1 < argc) {
+            ips = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--no-fast-forward") {
+            fast_forward = false;
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--lanes" && i + 1 < argc) {
+            lanes = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--backend" && i + 1 < argc) {
+            if (!Chip8::parseBackend(argv[++i], backend)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--compare") {
+            compare = true;
+            if (i + 1 < argc && std::isdigit(argv[i + 1][0])) {
+                compare_step = std::strtoull(argv[++i], nullptr, 10);
+            }
+        } else if (arg == "--load-state" && i + 1 < argc) {
+            load_state = argv[++i];
+        } else if (arg == "--save-state" && i + 1 < argc) {
+            save_state = argv[++i];
+        } else if (arg == "--profile" && i + 1 < argc) {
+            profile = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replay = argv[++i];
+        } else if (arg == "--observe" && i + 1 < argc) {
+            observe = argv[++i];
+        } else if (arg == "--observe-log" && i + 1 < argc) {
+            observe_log = argv[++i];
+        } else if (arg == "--no-dump") {
+            dump = false;
+        } else if (!rom_file && arg[0] != '-') {
+            rom_file = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (rom_file && replay) {
+        return runReplay(rom_file, replay, backend, fast_forward, dump);
+    }
+
+    if (!rom_file || (cycles == 0 && frames == 0) || ips == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (frames > 0) {
+        // cumulative cycles of the scheduler's first N frames.
+        cycles = frames * ips / TIMER_HZ;
+    }
+
+    if (lanes > 0) {
+        return runLanes(rom_file, lanes, ips, seed, cycles);
+    }
+
+    if (compare) {
+        return runCompare(rom_file, backend, ips, seed, cycles, compare_step > 0 ? compare_step : 1);
+    }
+
+    Chip8 *cpu = new Chip8();
+    cpu->setBackend(backend);
+    cpu->setFastForward(fast_forward);
+    cpu->setSeed(seed);
+    if (!cpu->loadRom(rom_file)) {
+        delete cpu;
+        return 1;
+    }
+    // resume from a snapshot, the rom in it replaces the one just loaded.
+    if (load_state && !cpu->loadState(load_state)) {
+        delete cpu;
+        return 1;
+    }
+
+    // uncapped: frames back to back, timers still tick every 1/60 s of emulated time.
+    Scheduler scheduler(cpu, ips);
+    scheduler.setMode(Scheduler::Mode::Uncapped);
+
+    Profiler *profiler = nullptr;
+    if (profile) {
+        if (!PROFILER_ENABLED) {
+            std::cerr << "built without CHIPS_PROFILE, --profile has nothing to report." << std::endl;
+        }
+        profiler = new Profiler();
+        cpu->setProfiler(profiler);
+    }
+
+    // every finished frame goes out to the ring and/or the log.
+    FrameStream *stream = nullptr;
+    if (observe || observe_log) {
+        stream = new FrameStream();
+        if ((observe && !stream->openShared(observe)) || (observe_log && !stream->openLog(observe_log))) {
+            delete stream;
+            delete cpu;
+            return 1;
+        }
+        scheduler.setFrameCallback([&] {
+            stream->publish(*cpu, scheduler.getFrameCount(), scheduler.getCycleCount());
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    scheduler.runCycles(cycles);
+    auto end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end - start).count();
+
+    if (dump) {
+        dumpGraphics(*cpu);
+        dumpRegisters(*cpu);
+    }
+    std::cout << "cycles: " << cycles << " frames: " << scheduler.getFrameCount()
+              << " time: " << std::fixed << std::setprecision(6) << secs << "s"
+              << " cycles/s: " << std::setprecision(0) << executedRate(cycles, cpu->getIdleCycles(), secs)
+              << " idle: " << cpu->getIdleCycles() << std::endl;
+
+    int status = 0;
+    if (profiler) {
+        // PREFIX.txt and PREFIX.json for the report, PREFIX.folded for flamegraph.pl.
+        std::string prefix = profile;
+        std::ofstream text(prefix + ".txt"), json(prefix + ".json"), folded(prefix + ".folded");
+        uint8_t mem[MEM_SIZE];
+        cpu->copyMemory(mem);
+        profiler->report(std::cout, mem);
+        profiler->report(text, mem);
+        profiler->reportJson(json, mem);
+        profiler->collapsedStacks(folded);
+        if (!text || !json || !folded) {
+            std::cerr << "failed to write the profile." << std::endl;
+            status = 1;
+        }
+        cpu->setProfiler(nullptr);
+        delete profiler;
+    }
+
+    if (save_state && !cpu->saveState(save_state)) {
+        status = 1;
+    }
+    if (stream) {
+        if (!stream->close()) {
+            status = 1;
+        }
+        delete stream;
+    }
+
+    delete cpu;
+    return status;
+}
@@ -0,0 +1,128 @@
+#include <thread>
+#include <algorithm>
+
+#include "scheduler.hpp"
+
+Scheduler::Scheduler(Chip8 *chips, uint32_t ips)
+    : chips(chips), ips(ips), mode(Mode::Realtime), max_catchup(MAX_CATCHUP_FRAMES),
+      frames(0), cycles(0) {
+    frame_left = cyclesInFrame(0);
+    next_frame = Clock::now();
+}
+
+Scheduler::Clock::duration Scheduler::period() {
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / TIMER_HZ));
+}
+
+uint32_t Scheduler::cyclesInFrame(uint64_t frame) const {
+    // cumulative cycles at the end of frame k is (k + 1) * ips / 60, rounded down.
+    return (frame + 1) * ips / TIMER_HZ - frame * ips / TIMER_HZ;
+}
+
+void Scheduler::setMode(Mode m) {
+    mode = m;
+    next_frame = Clock::now();
+}
+
+Scheduler::Mode Scheduler::getMode() const {
+    return mode;
+}
+
+void Scheduler::setIps(uint32_t new_ips) {
+    ips = std::max<uint32_t>(new_ips, 1);
+    frame_left = std::min(frame_left, cyclesInFrame(frames));
+}
+
+uint32_t Scheduler::getIps() const {
+    return ips;
+}
+
+void Scheduler::setMaxCatchup(uint32_t n) {
+    max_catchup = std::max<uint32_t>(n, 1);
+}
+
+void Scheduler::setFrameCallback(std::function<void()> callback) {
+    frame_callback = std::move(callback);
+}
+
+void Scheduler::runCycles(uint64_t n) {
+    while (n > 0) {
+        uint32_t chunk = std::min<uint64_t>(n, frame_left);
+        chips->run(chunk);
+        cycles += chunk;
+        n -= chunk;
+        frame_left -= chunk;
+
+        if (frame_left == 0) {
+            endFrame();
+        }
+    }
+}
+
+void Scheduler::endFrame() {
+    chips->timers();
+    frames++;
+    frame_left = cyclesInFrame(frames);
+    if (frame_callback) {
+        frame_callback();
+    }
+}
+
+void Scheduler::runFrame() {
+    uint64_t frame = frames;
+    runCycles(frame_left);
+    // below 60 ips some frames get no cycles at all, they still tick the timers.
+    if (frames == frame) {
+        endFrame();
+    }
+}
+
+uint32_t Scheduler::update() {
+    auto now = Clock::now();
+    uint32_t ran = 0;
+
+    if (mode == Mode::Uncapped) {
+        // as many frames as fit in one host frame, so the caller can still draw at 60 fps.
+        auto deadline = now + period();
+        do {
+            runFrame();
+            ran++;
+        } while (Clock::now() < deadline);
+        next_frame = Clock::now();
+        return ran;
+    }
+
+    if (now < next_frame) {
+        return 0;
+    }
+
+    int64_t due = (now - next_frame) / period() + 1;
+    bool dropped = due > int64_t(max_catchup);
+    if (dropped) {
+        // too far behind, run what we may and forget about the rest.
+        due = max_catchup;
+    }
+    for (; ran < uint32_t(due); ran++) {
+        runFrame();
+    }
+    next_frame = dropped ? now + period() : next_frame + period() * due;
+    return ran;
+}
+
+void Scheduler::waitNextFrame() {
+    if (mode == Mode::Realtime) {
+        std::this_thread::sleep_until(next_frame);
+    }
+}
+
+void Scheduler::resync() {
+    next_frame = Clock::now() + period();
+}
+
+uint64_t Scheduler::getFrameCount() const {
+    return frames;
+}
+
+uint64_t Scheduler::getCycleCount() const {
+    return cycles;
+}
@@ -0,0 +1,67 @@
+#ifndef CHIPS_SCHEDULER
+#define CHIPS_SCHEDULER
+
+#include <cstdint>
+#include <chrono>
+#include <functional>
+
+#include "chip8.hpp"
+
+#define TIMER_HZ 60            // delay and sound timer rate, also the frame rate
+#define DEFAULT_IPS 700        // instructions per second
+#define MAX_CATCHUP_FRAMES 5   // frames run back to back at most after a host stall
+
+// drives a Chip8 at a fixed instruction rate with the timers at exactly 60 Hz.
+//
+// emulated time is counted in frames of 1/60 s. frame k always gets the same
+// number of cycles for a given ips (ips / 60, with the remainder spread over
+// the frames so that a second is exactly ips cycles), and the timers tick once
+// at the end of every frame. so the cycles per frame never depend on the host,
+// only how fast frames are run does:
+//  - Realtime runs frames against the host clock. after a stall it catches up
+//    by up to max_catchup frames and drops the rest.
+//  - Uncapped runs frames back to back as fast as the host can.
+class Scheduler {
+public:
+    enum class Mode {
+        Realtime,
+        Uncapped
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Chip8 *chips;
+    uint32_t ips;
+    Mode mode;
+    uint32_t max_catchup;
+    uint64_t frames;      // completed frames
+    uint64_t cycles;      // cycles run in total
+    uint32_t frame_left;  // cycles left in the current frame
+    Clock::time_point next_frame;
+    std::function<void()> frame_callback;
+
+    static Clock::duration period();
+    uint32_t cyclesInFrame(uint64_t frame) const;
+    void endFrame(); // timer tick, callback, on to the next frame
+public:
+    Scheduler(Chip8 *chips, uint32_t ips = DEFAULT_IPS);
+
+    void setMode(Mode m);
+    Mode getMode() const;
+    void setIps(uint32_t ips);
+    uint32_t getIps() const;
+    void setMaxCatchup(uint32_t frames);
+    void setFrameCallback(std::function<void()> callback); // runs after every frame's timer tick
+
+    void runCycles(uint64_t n); // ticks the timers at every frame boundary it crosses
+    void runFrame();            // the rest of the current frame, then one timer tick
+    uint32_t update();          // the frames due by now (Realtime) or one host frame's worth (Uncapped)
+    void waitNextFrame();       // sleep until the next frame is due, Realtime only
+    void resync();              // forget the time since the last frame (pauses), next one is due in 1/60 s
+
+    uint64_t getFrameCount() const;
+    uint64_t getCycleCount() const;
+};
+
+#endif
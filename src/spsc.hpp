@@ -0,0 +1,49 @@
+#ifndef CHIPS_SPSC
+#define CHIPS_SPSC
+
+#include <atomic>
+#include <cstddef>
+
+// lock-free bounded queue, one producer thread and one consumer thread.
+//
+// the producer only writes tail, the consumer only writes head, each reads
+// the other's with acquire. neither side ever waits: push() fails when the
+// queue is full and the consumer checks front() for nullptr. N must be a
+// power of two, one slot is always left empty.
+template <typename T, size_t N>
+class SpscQueue {
+private:
+    static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+    T slots[N];
+    alignas(64) std::atomic<size_t> head; // next to pop, consumer only
+    alignas(64) std::atomic<size_t> tail; // next to push, producer only
+public:
+    SpscQueue() : slots(), head(0), tail(0) {}
+
+    bool push(const T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (((t + 1) & (N - 1)) == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slots[t] = value;
+        tail.store((t + 1) & (N - 1), std::memory_order_release);
+        return true;
+    }
+
+    // the oldest value, nullptr if there is none. stays put until pop().
+    const T* front() const {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots[h];
+    }
+
+    void pop() {
+        size_t h = head.load(std::memory_order_relaxed);
+        head.store((h + 1) & (N - 1), std::memory_order_release);
+    }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+#include "trace.hpp"
+
+namespace {
+
+// explicit little-endian, trace files move between machines.
+void put(std::vector<uint8_t> &out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out.push_back(uint8_t(value >> (8 * i)));
+    }
+}
+
+uint64_t get(const uint8_t *&in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= uint64_t(in[i]) << (8 * i);
+    }
+    in += bytes;
+    return value;
+}
+
+const size_t HEADER_SIZE = 4 + 4 + 8 + 4 + 4 + 8 + 8 + 4 + 4;
+const size_t RUN_SIZE = 4 + 2;
+const size_t CHECKPOINT_SIZE = 8 + 8;
+
+}
+
+uint64_t romHash(const uint8_t *mem) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = START_ADDR; i < MEM_SIZE; i++) {
+        hash ^= mem[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t romHash(const Chip8& chips) {
+    uint8_t mem[MEM_SIZE];
+    chips.copyMemory(mem);
+    return romHash(mem);
+}
+
+InputTrace::InputTrace() : seed(DEFAULT_SEED), ips(0), rom_hash(0) {
+}
+
+void InputTrace::addFrame(uint16_t mask) {
+    if (!runs.empty() && runs.back().mask == mask && runs.back().length < UINT32_MAX) {
+        runs.back().length++;
+    } else {
+        runs.push_back({1, mask});
+    }
+}
+
+void InputTrace::addCheckpoint(uint64_t frame, uint64_t hash) {
+    checkpoints.push_back({frame, hash});
+}
+
+uint64_t InputTrace::frames() const {
+    uint64_t total = 0;
+    for (const Run &run : runs) {
+        total += run.length;
+    }
+    return total;
+}
+
+bool InputTrace::save(const std::string& trace_file) const {
+    std::vector<uint8_t> data;
+    put(data, TRACE_MAGIC, 4);
+    put(data, TRACE_VERSION, 4);
+    put(data, seed, 8);
+    put(data, ips, 4);
+    put(data, 0, 4);
+    put(data, rom_hash, 8);
+    put(data, frames(), 8);
+    put(data, runs.size(), 4);
+    put(data, checkpoints.size(), 4);
+    for (const Run &run : runs) {
+        put(data, run.length, 4);
+        put(data, run.mask, 2);
+    }
+    for (const Checkpoint &checkpoint : checkpoints) {
+        put(data, checkpoint.frame, 8);
+        put(data, checkpoint.hash, 8);
+    }
+
+    std::ofstream out(trace_file, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!out) {
+        std::cerr << "failed to write trace file." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool InputTrace::load(const std::string& trace_file) {
+    std::ifstream in(trace_file, std::ios::in | std::ios::binary);
+    if (!in) {
+        std::cerr << "failed to read trace file." << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    const uint8_t *p = data.data();
+    if (data.size() < HEADER_SIZE || get(p, 4) != TRACE_MAGIC || get(p, 4) != TRACE_VERSION) {
+        std::cerr << "not a chips trace, or from another version." << std::endl;
+        return false;
+    }
+    seed = get(p, 8);
+    ips = get(p, 4);
+    get(p, 4);
+    rom_hash = get(p, 8);
+    uint64_t total = get(p, 8);
+    uint64_t num_runs = get(p, 4);
+    uint64_t num_checkpoints = get(p, 4);
+    if (data.size() != HEADER_SIZE + num_runs * RUN_SIZE + num_checkpoints * CHECKPOINT_SIZE) {
+        std::cerr << "trace file is truncated." << std::endl;
+        return false;
+    }
+
+    runs.resize(num_runs);
+    for (Run &run : runs) {
+        run.length = get(p, 4);
+        run.mask = get(p, 2);
+    }
+    checkpoints.resize(num_checkpoints);
+    for (Checkpoint &checkpoint : checkpoints) {
+        checkpoint.frame = get(p, 8);
+        checkpoint.hash = get(p, 8);
+    }
+    if (frames() != total) {
+        std::cerr << "trace file is corrupt." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+TraceCursor::TraceCursor(const InputTrace *trace) : trace(trace), run(0), used(0) {
+}
+
+uint16_t TraceCursor::next() {
+    while (run < trace->runs.size() && used == trace->runs[run].length) {
+        run++;
+        used = 0;
+    }
+    if (run == trace->runs.size()) {
+        return 0;
+    }
+    used++;
+    return trace->runs[run].mask;
+}
@@ -0,0 +1,71 @@
+#ifndef CHIPS_TRACE
+#define CHIPS_TRACE
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "chip8.hpp"
+
+#define TRACE_MAGIC 0x54384843 // "CH8T" read as a little-endian uint32_t
+#define TRACE_VERSION 1
+#define TRACE_CHECKPOINT_FRAMES 600 // the recorder hashes the display every 10 s
+
+// recorded input for one run of a rom.
+//
+// keys are sampled once per frame (1/60 s of emulated time, see Scheduler)
+// as a 16-bit mask, bit k for key k, and stored run-length encoded since
+// they rarely change between frames. the seed and ips make the run repeat
+// exactly: ips fixes the cycles in every frame the same way the scheduler
+// spreads them. checkpoints are display hashes (frameHash) at the end of
+// some frames, for checking a replay against the recording.
+//
+// file layout, little-endian:
+//     uint32 magic, uint32 version, uint64 seed, uint32 ips, uint32 reserved,
+//     uint64 rom hash, uint64 frames, uint32 runs, uint32 checkpoints,
+//     runs x {uint32 length, uint16 mask}, checkpoints x {uint64 frame, uint64 hash}
+class InputTrace {
+public:
+    struct Run {
+        uint32_t length; // frames
+        uint16_t mask;
+    };
+
+    struct Checkpoint {
+        uint64_t frame;  // frames completed when the hash was taken
+        uint64_t hash;
+    };
+
+    uint64_t seed;
+    uint32_t ips;
+    uint64_t rom_hash; // romHash() of the rom it was recorded on, 0 if unknown
+    std::vector<Run> runs;
+    std::vector<Checkpoint> checkpoints;
+
+    InputTrace();
+
+    void addFrame(uint16_t mask);
+    void addCheckpoint(uint64_t frame, uint64_t hash);
+    uint64_t frames() const;
+
+    bool save(const std::string& trace_file) const;
+    bool load(const std::string& trace_file);
+};
+
+// walks the runs of a trace frame by frame. past the end all keys are up.
+class TraceCursor {
+private:
+    const InputTrace *trace;
+    size_t run;
+    uint32_t used; // frames of the current run already returned
+public:
+    explicit TraceCursor(const InputTrace *trace);
+    uint16_t next(); // the mask for the next frame
+};
+
+// fnv-1a of the program area (START_ADDR up) of a freshly loaded machine's memory.
+uint64_t romHash(const uint8_t *mem);
+uint64_t romHash(const Chip8& chips);
+
+#endif
@@ -0,0 +1,370 @@
+// chips-aot: translates a rom to C++ ahead of time, see aot.hpp.
+//
+// the walk starts at START_ADDR and follows 1nnn, 2nnn (and the return
+// address after it), both sides of every skip and the even targets of Bnnn
+// up to nnn + 0xFF. a block is straight-line code up to the first jump, skip,
+// call or return, or up to Fx33/Fx55 since a store may hit translated code.
+// Fx0A and invalid opcodes are left to the interpreter and end a block
+// before them. everything the walk doesn't reach, or that lies outside the
+// rom, runs through the decode cache at run time.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cctype>
+#include <cstdlib>
+
+#include "chip8.hpp"
+#include "aot.hpp"
+#include "romcache.hpp"
+
+namespace {
+
+struct Block {
+    uint16_t addr;
+    int length;
+    std::vector<std::string> lines; // one per instruction
+    std::string tail;               // the return after the last one, if it isn't an exit
+};
+
+std::string hex(unsigned value, int digits) {
+    std::ostringstream out;
+    out << "0x" << std::hex << std::setw(digits) << std::setfill('0') << value;
+    return out.str();
+}
+
+class Translator {
+private:
+    std::span<const uint8_t> rom;
+    std::map<uint16_t, Block> blocks;
+    std::set<uint16_t> seen;
+    std::vector<uint16_t> work;
+
+    // both bytes of the instruction at addr come from the rom.
+    bool inRom(uint32_t addr) const {
+        return addr >= START_ADDR && addr + 1 < START_ADDR + rom.size();
+    }
+    uint16_t opcodeAt(uint16_t addr) const {
+        return (rom[addr - START_ADDR] << 8) | rom[addr - START_ADDR + 1];
+    }
+    void follow(uint32_t addr) {
+        if (inRom(addr) && seen.insert(addr).second) {
+            work.push_back(addr);
+        }
+    }
+
+    // the statement for an instruction that doesn't end a block, empty if it
+    // ends one or can't be translated.
+    static std::string body(uint16_t opcode);
+    // the return statement for a jump, skip, call or return, empty otherwise.
+    // the targets it can reach go into next.
+    static std::string exit(uint16_t addr, uint16_t opcode, std::vector<uint32_t> &next);
+    void translate(uint16_t addr);
+public:
+    explicit Translator(std::span<const uint8_t> rom) : rom(rom) {}
+
+    void walk();
+    void write(std::ostream &out, const std::string &name, const std::string &source) const;
+    size_t blockCount() const { return blocks.size(); }
+    size_t instructionCount() const;
+    size_t coveredBytes() const;
+};
+
+std::string Translator::body(uint16_t opcode) {
+    std::string x = hex((opcode & 0x0F00) >> 8, 1);
+    std::string y = hex((opcode & 0x00F0) >> 4, 1);
+    std::string kk = hex(opcode & 0x00FF, 2);
+    std::string nnn = hex(opcode & 0x0FFF, 3);
+    std::string vx = "m.v[" + x + "]";
+    std::string vy = "m.v[" + y + "]";
+    std::string vf = "m.v[0xf]";
+
+    // same semantics and flag write order as Chip8::interpret().
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            return opcode == 0x00E0 ? "m.cls();" : "";
+        case 0x6000:
+            return vx + " = " + kk + ";";
+        case 0x7000:
+            return vx + " += " + kk + ";";
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0: return vx + " = " + vy + ";";
+                case 0x1: return vx + " |= " + vy + ";";
+                case 0x2: return vx + " &= " + vy + ";";
+                case 0x3: return vx + " ^= " + vy + ";";
+                case 0x4: return vf + " = " + vx + " + " + vy + " > 0xff; " + vx + " += " + vy + ";";
+                case 0x5: return vf + " = " + vx + " > " + vy + "; " + vx + " -= " + vy + ";";
+                case 0x6: return vf + " = " + vx + " & 1; " + vx + " >>= 1;";
+                case 0x7: return vf + " = " + vx + " < " + vy + "; " + vx + " = " + vy + " - " + vx + ";";
+                case 0xE: return vf + " = " + vx + " >> 7; " + vx + " <<= 1;";
+            }
+            return "";
+        case 0xA000:
+            return "m.index = " + nnn + ";";
+        case 0xC000:
+            return vx + " = m.rnd() & " + kk + ";";
+        case 0xD000:
+            return "m.draw(" + x + ", " + y + ", " + std::to_string(opcode & 0x000F) + ");";
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x07: return vx + " = m.delay();";
+                case 0x15: return "m.setDelay(" + x + ");";
+                case 0x18: return "m.setSound(" + x + ");";
+                case 0x1E: return "m.index += " + vx + ";";
+                case 0x29: return "m.index = FONT_ADDR + " + vx + " * 5;";
+                case 0x65: return "m.load(" + x + ");";
+            }
+            return "";
+    }
+    return "";
+}
+
+std::string Translator::exit(uint16_t addr, uint16_t opcode, std::vector<uint32_t> &next) {
+    std::string x = hex((opcode & 0x0F00) >> 8, 1);
+    std::string y = hex((opcode & 0x00F0) >> 4, 1);
+    std::string kk = hex(opcode & 0x00FF, 2);
+    uint16_t nnn = opcode & 0x0FFF;
+    std::string vx = "m.v[" + x + "]";
+    std::string vy = "m.v[" + y + "]";
+    std::string after = hex(addr + 2, 4);
+    std::string skipped = hex(addr + 4, 4);
+
+    auto skip = [&](const std::string &cond) {
+        next.push_back(addr + 2);
+        next.push_back(addr + 4);
+        return "return " + cond + " ? " + skipped + " : " + after + ";";
+    };
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            return opcode == 0x00EE ? "return m.ret();" : "";
+        case 0x1000:
+            next.push_back(nnn);
+            return "return " + hex(nnn, 4) + ";";
+        case 0x2000:
+            next.push_back(nnn);
+            next.push_back(addr + 2);
+            return "m.call(" + after + "); return " + hex(nnn, 4) + ";";
+        case 0x3000:
+            return skip(vx + " == " + kk);
+        case 0x4000:
+            return skip(vx + " != " + kk);
+        case 0x5000:
+            return skip(vx + " == " + vy);
+        case 0x9000:
+            return skip(vx + " != " + vy);
+        case 0xB000:
+            // a jump table, usually indexed in whole instructions.
+            for (uint32_t offset = 0; offset <= 0xFF; offset += 2) {
+                next.push_back(nnn + offset);
+            }
+            return "return (" + hex(nnn, 4) + " + m.v[0x0]) & (MEM_SIZE - 1);";
+        case 0xE000:
+            if ((opcode & 0x00FF) == 0x9E) {
+                return skip("m.key(" + x + ")");
+            }
+            if ((opcode & 0x00FF) == 0xA1) {
+                return skip("!m.key(" + x + ")");
+            }
+            return "";
+        case 0xF000:
+            // stores end the block too, they may have hit translated code.
+            if ((opcode & 0x00FF) == 0x33) {
+                next.push_back(addr + 2);
+                return "m.bcd(" + x + "); return " + after + ";";
+            }
+            if ((opcode & 0x00FF) == 0x55) {
+                next.push_back(addr + 2);
+                return "m.store(" + x + "); return " + after + ";";
+            }
+            return "";
+    }
+    return "";
+}
+
+void Translator::translate(uint16_t start) {
+    Block block = {start, 0, {}, ""};
+    std::vector<uint32_t> next;
+    uint16_t addr = start;
+    bool ended = false;
+    while (!ended) {
+        if (!inRom(addr)) {
+            break; // ran off the rom, the interpreter takes it from here
+        }
+        if (block.length == AOT_MAX_BLOCK) {
+            next.push_back(addr);
+            break;
+        }
+        uint16_t opcode = opcodeAt(addr);
+        std::string comment = "    // " + hex(addr, 3).substr(2) + ": " + hex(opcode, 4).substr(2);
+        std::string line = body(opcode);
+        if (line.empty()) {
+            line = exit(addr, opcode, next);
+            if (line.empty()) {
+                // Fx0A or an invalid opcode, left to the interpreter. the
+                // instruction after it is an entry point of its own.
+                next.push_back(addr + 2);
+                break;
+            }
+            ended = true;
+        }
+        block.lines.push_back(line + comment);
+        block.length++;
+        addr += 2;
+    }
+    if (!ended && block.length > 0) {
+        block.tail = "return " + hex(addr, 4) + ";";
+    }
+
+    if (block.length > 0) {
+        blocks[start] = block;
+    }
+    for (uint32_t target : next) {
+        follow(target);
+    }
+}
+
+void Translator::walk() {
+    follow(START_ADDR);
+    while (!work.empty()) {
+        uint16_t addr = work.back();
+        work.pop_back();
+        translate(addr);
+    }
+}
+
+size_t Translator::instructionCount() const {
+    size_t count = 0;
+    for (const auto &[addr, block] : blocks) {
+        count += block.length;
+    }
+    return count;
+}
+
+size_t Translator::coveredBytes() const {
+    std::set<uint16_t> bytes;
+    for (const auto &[addr, block] : blocks) {
+        for (int i = 0; i < 2 * block.length; i++) {
+            bytes.insert(addr + i);
+        }
+    }
+    return bytes.size();
+}
+
+void Translator::write(std::ostream &out, const std::string &name, const std::string &source) const {
+    out << "// generated by chips-aot from " << source << ", don't edit.\n"
+        << "// " << blocks.size() << " blocks, " << instructionCount() << " instructions.\n\n"
+        << "#include \"aot.hpp\"\n\n"
+        << "namespace {\n\n"
+        << "const uint8_t rom[] = {";
+    for (size_t i = 0; i < rom.size(); i++) {
+        out << (i % 16 == 0 ? "\n    " : " ") << hex(rom[i], 2) << ",";
+    }
+    out << "\n};\n";
+
+    for (const auto &[addr, block] : blocks) {
+        // entered at any of its instructions, see AotBlock.
+        out << "\nuint16_t block_" << hex(addr, 3).substr(2) << "(Chip8 &chips, unsigned from, unsigned to) {\n"
+            << "    AotMachine m(chips);\n"
+            << "    switch (from) {\n"
+            << "    default:\n";
+        for (int i = 0; i < block.length; i++) {
+            if (i > 0) {
+                out << "        if (to == " << i << ") return " << hex(addr + 2 * i, 4) << ";\n"
+                    << "        [[fallthrough]];\n";
+            }
+            out << "    case " << i << ":\n"
+                << "        " << block.lines[i] << "\n";
+        }
+        out << "    }\n";
+        if (!block.tail.empty()) {
+            out << "    " << block.tail << "\n";
+        }
+        out << "}\n";
+    }
+
+    out << "\nconst AotEntry entries[] = {\n";
+    for (const auto &[addr, block] : blocks) {
+        out << "    {" << hex(addr, 4) << ", " << block.length << ", block_" << hex(addr, 3).substr(2) << "},\n";
+    }
+    out << "};\n\n"
+        << "const AotProgram program = {\"" << name << "\", rom, sizeof(rom), entries, sizeof(entries) / sizeof(entries[0])};\n"
+        << "AotRegistrar registrar(program);\n\n"
+        << "}\n";
+}
+
+// file name without directories and extension, as a c identifier.
+std::string programName(const std::string &path) {
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    name = name.substr(0, name.find('.'));
+    for (char &c : name) {
+        if (!std::isalnum(static_cast<unsigned char>(c))) {
+            c = '_';
+        }
+    }
+    return name;
+}
+
+void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [-o out.cpp] [--name NAME] path/to/rom_file" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
+    const char *rom_file = nullptr;
+    std::string out_file;
+    std::string name;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            out_file = argv[++i];
+        } else if (arg == "--name" && i + 1 < argc) {
+            name = argv[++i];
+        } else if (arg[0] != '-' && !rom_file) {
+            rom_file = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!rom_file) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (name.empty()) {
+        name = programName(rom_file);
+    }
+
+    RomFile rom(rom_file);
+    if (!rom.ok()) {
+        return 1;
+    }
+
+    Translator translator(rom.bytes());
+    translator.walk();
+
+    std::string source = rom_file;
+    source = source.substr(source.find_last_of('/') + 1);
+
+    if (out_file.empty()) {
+        translator.write(std::cout, name, source);
+    } else {
+        std::ofstream out(out_file, std::ios::out | std::ios::trunc);
+        translator.write(out, name, source);
+        if (!out) {
+            std::cerr << "failed to write " << out_file << std::endl;
+            return 1;
+        }
+    }
+    std::cerr << name << ": " << translator.blockCount() << " blocks, " << translator.instructionCount()
+              << " instructions, " << translator.coveredBytes() << " of " << rom.bytes().size() << " rom bytes" << std::endl;
+    return 0;
+}
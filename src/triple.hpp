@@ -0,0 +1,53 @@
+#ifndef CHIPS_TRIPLE
+#define CHIPS_TRIPLE
+
+#include <atomic>
+#include <cstdint>
+
+// lock-free triple buffer, one writer thread and one reader thread.
+//
+// the writer fills back() and publish()es it, the reader calls read() and
+// looks at front(). the third slot sits in the middle and changes hands with
+// a single atomic exchange on either side, so neither ever waits: the writer
+// can publish as often as it likes (the reader just gets the newest), and
+// the reader keeps the same front until something newer shows up.
+template <typename T>
+class TripleBuffer {
+private:
+    static constexpr uint8_t INDEX = 0x3;
+    static constexpr uint8_t FRESH = 0x4; // published since the reader's last swap
+
+    struct alignas(64) Slot {
+        T value;
+    };
+
+    Slot slots[3];
+    alignas(64) std::atomic<uint8_t> middle;
+    alignas(64) uint8_t back_index;  // writer only
+    alignas(64) uint8_t front_index; // reader only
+public:
+    TripleBuffer() : slots(), middle(1), back_index(0), front_index(2) {}
+
+    T& back() {
+        return slots[back_index].value;
+    }
+
+    void publish() {
+        back_index = middle.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // true if a newer value was published, front() is then that value.
+    bool read() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        front_index = middle.exchange(front_index, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T& front() const {
+        return slots[front_index].value;
+    }
+};
+
+#endif
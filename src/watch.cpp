@@ -0,0 +1,121 @@
+// chips-watch: follows the frames a chips or chips-run publishes with
+// --observe, or reads back an --observe-log file, and prints them.
+//
+// one line per frame (frame, cycles, pc, registers, timers, keys), plus the
+// display with --screen. attached to a running machine it prints the newest
+// frame whenever there is one and says how many it missed in between, the
+// writer never waits for it.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+
+#include "observe.hpp"
+
+#define WATCH_POLL_MS 1
+
+static void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [--frames N] [--screen] SHM_NAME\n"
+              << "       " << prog << " [--frames N] [--screen] --log FILE" << std::endl;
+}
+
+static void printFrame(const ObservedFrame &f, bool screen) {
+    std::cout << "frame " << f.frame << " cycles " << f.cycles << std::hex << std::setfill('0')
+              << " pc " << std::setw(4) << f.pc << " i " << std::setw(4) << f.index << " v";
+    for (int i = 0; i < NUM_REGS; i++) {
+        std::cout << ' ' << std::setw(2) << +f.v[i];
+    }
+    std::cout << " dt " << std::setw(2) << +f.delay_timer << " st " << std::setw(2) << +f.sound_timer
+              << " keys " << std::setw(4) << f.keys << std::dec << std::setfill(' ') << '\n';
+    if (screen) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                std::cout << (getPixel(f.graphics, x, y) ? '#' : '.');
+            }
+            std::cout << '\n';
+        }
+    }
+}
+
+static int watchLog(const char *log_file, uint64_t frames, bool screen) {
+    FrameLogReader log;
+    if (!log.open(log_file)) {
+        return 1;
+    }
+    ObservedFrame f;
+    uint64_t read = 0;
+    while ((frames == 0 || read < frames) && log.next(f)) {
+        printFrame(f, screen);
+        read++;
+    }
+    std::cout << std::flush;
+    return 0;
+}
+
+static int watchShared(const char *shm_name, uint64_t frames, bool screen) {
+    FrameReader reader;
+    if (!reader.open(shm_name)) {
+        return 1;
+    }
+    ObservedFrame f;
+    uint64_t published = 0, last_frame = 0, shown = 0, missed = 0;
+    while (frames == 0 || shown < frames) {
+        // closed is read before published, so the last frames aren't lost.
+        bool closed = reader.closed();
+        uint64_t now = reader.published();
+        if (now == published) {
+            if (closed) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_POLL_MS));
+            continue;
+        }
+        published = now;
+        if (!reader.read(f)) {
+            continue;
+        }
+        if (shown > 0 && f.frame > last_frame + 1) {
+            missed += f.frame - last_frame - 1;
+        }
+        last_frame = f.frame;
+        printFrame(f, screen);
+        shown++;
+    }
+    std::cout << "frames shown: " << shown << " missed: " << missed << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    uint64_t frames = 0;
+    bool screen = false;
+    const char *log_file = nullptr;
+    const char *shm_name = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--screen") {
+            screen = true;
+        } else if (arg == "--log" && i + 1 < argc) {
+            log_file = argv[++i];
+        } else if (!shm_name && arg[0] != '-') {
+            shm_name = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (log_file && !shm_name) {
+        return watchLog(log_file, frames, screen);
+    }
+    if (shm_name && !log_file) {
+        return watchShared(shm_name, frames, screen);
+    }
+    usage(argv[0]);
+    return 1;
+}